@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <algorithm>
+#ifdef LATTE_HAVE_NUMA
+#include <numa.h>
+#endif
+#include "arena.h"
+
+BufferArena buffer_arena;
+
+int num_numa_nodes() {
+#ifdef LATTE_HAVE_NUMA
+    if (numa_available() >= 0) return numa_max_node() + 1;
+#endif
+    return 1;
+}
+
+int current_numa_node() {
+#ifdef LATTE_HAVE_NUMA
+    if (numa_available() >= 0) {
+        int node = numa_node_of_cpu(sched_getcpu());
+        if (node >= 0) return node;
+    }
+#endif
+    return 0;
+}
+
+// Bind the pages of a fresh mapping before they are first touched
+static void place_pages(void* base, size_t size, int node) {
+#ifdef LATTE_HAVE_NUMA
+    if (num_numa_nodes() < 2) return;
+    if (node == ARENA_INTERLEAVE) {
+        numa_interleave_memory(base, size, numa_all_nodes_ptr);
+    } else {
+        numa_tonode_memory(base, size, node);
+    }
+#endif
+}
+
+BufferArena::~BufferArena() {
+    trim();
+}
+
+void* BufferArena::acquire_bytes(size_t bytes, int node) {
+    bytes = std::max(bytes, (size_t) 1);
+    bytes = (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+    std::lock_guard<std::mutex> lock(mutex);
+    // Best fit among the released buffers placed the same way, at most
+    // twice the size a new buffer would have so that small requests do not
+    // pin large windows
+    size_t max_bytes = bytes >= HUGE_PAGE_SIZE ?
+        (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE * 2 : bytes * 2;
+    FreeBlocks::iterator it = free_blocks.lower_bound(bytes);
+    FreeBlocks::iterator end = free_blocks.upper_bound(max_bytes);
+    while (it != end && it->second.second.node != node) ++it;
+    if (it != end) {
+        void* base = it->second.first;
+        used[base] = it->second.second;
+        free_blocks.erase(it);
+        return base;
+    }
+    Block block;
+    block.node = node;
+    void* base;
+    if (bytes >= HUGE_PAGE_SIZE) {
+        block.size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        block.mapped = true;
+        // Over-allocate by one huge page and cut the mapping down to a huge
+        // page aligned range so the kernel can back all of it with huge pages
+        size_t length = block.size + HUGE_PAGE_SIZE;
+        char* map = (char*) mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(map != MAP_FAILED);
+        char* aligned = (char*) (((uintptr_t) map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+        if (aligned != map) munmap(map, aligned - map);
+        size_t tail = (map + length) - (aligned + block.size);
+        if (tail > 0) munmap(aligned + block.size, tail);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, block.size, MADV_HUGEPAGE);
+#endif
+        place_pages(aligned, block.size, node);
+        base = aligned;
+    } else {
+        block.size = bytes;
+        block.mapped = false;
+        int ret = posix_memalign(&base, ARENA_ALIGNMENT, bytes);
+        assert(ret == 0);
+    }
+    resident += block.size;
+    used[base] = block;
+    return base;
+}
+
+void BufferArena::release(void* p) {
+    if (p == NULL) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<void*, Block>::iterator it = used.find(p);
+    assert(it != used.end());
+    free_blocks.insert(std::make_pair(it->second.size, std::make_pair(p, it->second)));
+    used.erase(it);
+}
+
+void BufferArena::free_block(void* base, const Block& block) {
+    if (block.mapped) {
+        munmap(base, block.size);
+    } else {
+        free(base);
+    }
+    resident -= block.size;
+}
+
+void BufferArena::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (FreeBlocks::iterator it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+        free_block(it->second.first, it->second.second);
+    }
+    free_blocks.clear();
+}
+
+size_t BufferArena::resident_bytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident;
+}
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_IO_ARENA_H
+#define LATTE_IO_ARENA_H
+#include <stddef.h>
+#include <map>
+#include <mutex>
+
+// Alignment of every buffer handed out by the arena, a cache line and the
+// width of an AVX-512 store
+#define ARENA_ALIGNMENT 64
+// Buffers at least this large are mapped on transparent huge pages
+#define HUGE_PAGE_SIZE (2ul << 20)
+// Node of a buffer whose pages are interleaved over all NUMA nodes
+#define ARENA_INTERLEAVE -1
+
+// Number of NUMA nodes and node of the CPU the caller runs on, 1 and 0
+// when built without libnuma
+int num_numa_nodes();
+int current_numa_node();
+
+// Process wide pool of the window and batch buffers of every dataset.
+// Released buffers are kept and handed to later acquire calls of at most
+// their size and at least half of it, so that datasets which are not resident at the same time
+// (see Dataset::suspend) share the same memory.  trim() returns the unused
+// buffers to the system.
+//
+// Huge page buffers are interleaved over the NUMA nodes unless they are
+// acquired for a given node, so that a window filled by a single reader
+// thread does not end up on one socket.
+class BufferArena {
+    struct Block {
+        size_t size;
+        bool mapped;  // mmap'ed rather than posix_memalign'ed
+        int node;     // ARENA_INTERLEAVE or the node the pages are bound to
+    };
+    std::map<void*, Block> used;
+    // free buffers by size
+    typedef std::multimap<size_t, std::pair<void*, Block> > FreeBlocks;
+    FreeBlocks free_blocks;
+    std::mutex mutex;
+    size_t resident;
+    void free_block(void* base, const Block& block);
+    public:
+        template <typename T> T* acquire(size_t count, int node = ARENA_INTERLEAVE) {
+            return (T*) acquire_bytes(count * sizeof(T), node);
+        }
+        void* acquire_bytes(size_t bytes, int node = ARENA_INTERLEAVE);
+        // p may be NULL
+        void release(void* p);
+        void trim();
+        // Bytes held, used and free
+        size_t resident_bytes();
+
+        BufferArena() : resident(0) {}
+        ~BufferArena();
+};
+
+extern BufferArena buffer_arena;
+
+#endif /* LATTE_IO_ARENA_H */
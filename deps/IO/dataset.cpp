@@ -25,35 +25,274 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "dataset.h"
 #ifdef LATTE_BUILD_MPI
 #include "../communication/comm.h"
 #endif
 
-Dataset::Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use_mpi, bool divide_by_rank) {
+std::mutex hdf5_mutex;
+
+Dataset::Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use_mpi, int rank, int size,
+                 bool divide_by_rank, const DatasetOptions& options) {
 #ifdef LATTE_BUILD_MPI
-    int rank;
     if (_use_mpi) {
+        // Replicas of the same net subgroup split the dataset
         MPI_Comm_rank(get_inter_net_comm(), &rank);
-        debug("Rank %d : Initializing dataset %s (shuffle=%d, use_mpi=%d).", rank, data_file_name, _shuffle, _use_mpi);
+        MPI_Comm_size(get_inter_net_comm(), &size);
     }
-#else
-    debug("Initializing dataset %s.", data_file_name);
 #endif
+    debug("Rank %d : Initializing dataset %s (shuffle=%d, use_mpi=%d).", rank, data_file_name, _shuffle, _use_mpi);
     use_mpi = _use_mpi;
     shuffle = _shuffle;
     batch_size = _batch_size;
     epoch = 0;
     curr_item = 0;
+    prefetch = false;
+    prefetch_pending = false;
+    next_data_buffer = NULL;
+    next_label_buffer = NULL;
+    map_base = NULL;
+    map_length = 0;
+    crop_y = NULL;
+    crop_x = NULL;
+    flip = NULL;
+    collective = false;
+    num_parts = 1;
+    chunk_offset = 0;
+    data_shape = NULL;
+    label_shape = NULL;
+    out_shape = NULL;
+    chunks = NULL;
+    batch_idxs = NULL;
+    data_buffer = NULL;
+    label_buffer = NULL;
+    share_buffers = false;
+    suspended = false;
+    numa_replicas = false;
+    rng.seed(options.seed);
+    max_open_files = options.max_open_files;
+    open_files = 0;
+    shard_clock = 0;
+    streaming = false;
+
+    std::unique_lock<std::mutex> lock(hdf5_mutex);
+    if (is_raw_file(data_file_name)) {
+        open_raw(data_file_name);
+    } else {
+        open_hdf5(data_file_name);
+    }
+    lock.unlock();
+
+    num_total_items = data_shape[0];
+    // Rows per storage chunk, taken from the first shard
+    int chunk_items = shards.empty() ? 0 : shards[0].storage_chunk_items;
+    if (use_mpi && options.collective_io && shards.size() > 1) {
+        std::cerr << "Warning: collective reads need a single file, reading shards independently" << std::endl;
+    }
+    if (use_mpi && options.collective_io && shards.size() == 1 && !options.streaming) {
+#ifdef LATTE_BUILD_MPI
+        // Slabs are drawn from the whole file and reassigned to ranks every
+        // epoch, every rank shuffles them with the same seed
+        collective = true;
+        num_parts = size;
+        unsigned int seed = rng();
+        MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, get_inter_net_comm());
+        slab_rng.seed(seed);
+        chunk_start = 0;
+        chunk_end = num_total_items;
+        debug("Rank %d : collective reads over %d items, seed %u", rank, num_total_items, seed);
+#endif
+    } else if (use_mpi || size > 1) { // && divide_by_rank) {
+        int chunk_size = num_total_items / size + 1;
+        if (shards.size() >= size) {
+            // Hand out whole shards so that a rank only opens its own files
+            int next = (rank + 1) * shards.size() / size;
+            chunk_start = shards[rank * shards.size() / size].first;
+            chunk_end = next < shards.size() ? shards[next].first : num_total_items;
+        } else {
+            if (chunk_items > 0) {
+                // Do not let two ranks inflate the same storage chunk
+                chunk_size = (chunk_size + chunk_items - 1) / chunk_items * chunk_items;
+            }
+            chunk_start = rank * chunk_size;
+            chunk_end = std::min(chunk_start+chunk_size, num_total_items);
+        }
+        num_total_items = chunk_end - chunk_start;
+        debug("Rank %d : chunk_size=%d, chunk_start=%d, chunk_end=%d, num_total_items=%d", rank, chunk_size, chunk_start, chunk_end, num_total_items);
+    } else {
+        chunk_start = 0;
+        chunk_end = num_total_items;
+    }
+    debug("data_item_size %d", data_item_size);
+    debug("num_total_items %d", num_total_items);
+    out_shape = data_shape;
+    out_item_size = data_item_size;
+
+    if (map_base != NULL) {
+        // The whole mapped payload is the window, items are gathered straight
+        // from the page cache and the shuffle covers this rank's entire range
+        num_local_items = num_total_items;
+        slabs_per_window = 1;
+        slab_size = num_local_items;
+        data_buffer += (size_t) chunk_start * data_item_size * data_type_size;
+        label_buffer += (size_t) chunk_start * label_item_size;
+        madvise(map_base, map_length, shuffle ? MADV_RANDOM : MADV_SEQUENTIAL);
+    } else if (options.streaming && background_reads_allowed("streaming")) {
+        // No resident window, every batch is read item by item in a global
+        // permutation of this rank's items
+        streaming = true;
+        num_local_items = batch_size;
+        start_stream(std::max(options.read_ahead, 1));
+        debug("streaming %d items, %d batches read ahead", num_total_items, options.read_ahead);
+        return;
+    } else {
+        // The resident window holds as many items as fit in the memory budget
+        size_t item_bytes = data_item_size * data_type_size + label_item_size * sizeof(float);
+        size_t budget_items = options.memory_budget / item_bytes;
+        // make it a multiple of batch_size
+        budget_items = std::max((budget_items/batch_size)*batch_size, (size_t) batch_size);
+        int rank_items = num_total_items / num_parts;
+        if (rank_items > budget_items) {
+            num_local_items = budget_items;
+            // The window is assembled from window_slabs randomly chosen slabs
+            slabs_per_window = std::max(1, std::min(options.window_slabs, num_local_items));
+        } else {
+            num_local_items = rank_items;
+            // Collective mode rereads the window every epoch so that each
+            // rank sees different slabs, it is still split into slabs
+            slabs_per_window = collective ?
+                std::max(1, std::min(options.window_slabs, num_local_items)) : 1;
+        }
+        slab_size = num_local_items / slabs_per_window;
+        if (num_local_items < rank_items && slab_size > chunk_items && chunk_items > 0) {
+            // Partial windows are read a slab at a time, keep the slabs on
+            // storage chunk boundaries so no chunk is inflated for a few rows
+            slab_size -= slab_size % chunk_items;
+        }
+        if (slab_size * slabs_per_window < batch_size) {
+            // get_next_batch needs at least one batch in the window
+            slab_size = (batch_size + slabs_per_window - 1) / slabs_per_window;
+        }
+        num_local_items = slab_size * slabs_per_window;
+        // Collective reads have to stay in step with the other ranks, the
+        // window cannot be reread at an arbitrary time
+        share_buffers = options.share_buffers && !collective;
+        if (options.numa_replicas && num_numa_nodes() > 1) {
+            // replicas[0] stands for data_buffer, which is placed on node 0
+            numa_replicas = true;
+            replicas.resize(num_numa_nodes(), NULL);
+            next_replicas.resize(num_numa_nodes(), NULL);
+        }
+        if (!collective) {
+            // The first window is read by the first get_next_batch, so that
+            // restoring a saved state only reads the window it resumes in
+            suspended = true;
+        } else {
+            data_buffer = acquire_window();
+            label_buffer = buffer_arena.acquire<float>((size_t) num_local_items*label_item_size);
+        }
+    }
+
+    chunk_idx = 0;
+    n_total_chunks = num_total_items / slab_size;
+    chunks = new int[n_total_chunks];
+    for (int i = 0; i < n_total_chunks; i++) {
+        chunks[i] = chunk_start + slab_size * i;
+    }
+    // Each rank reads its own n_chunks entries of chunks, all of them unless
+    // reading collectively
+    n_chunks = n_total_chunks / num_parts;
+#ifdef LATTE_BUILD_MPI
+    if (collective) chunk_offset = rank * n_chunks;
+#endif
+    shuffle_chunks();
+
+    debug("num_local_items %d (%d slabs of %d items)", num_local_items, slabs_per_window, slab_size);
+    batch_idxs = buffer_arena.acquire<int>(num_local_items);
+    for (int i = 0; i < num_local_items; i++) batch_idxs[i] = i;
+    fetch_next_chunk(map_base == NULL);
+}
+
+void Dataset::open_hdf5(char* data_file_name) {
+    if (H5Fis_hdf5(data_file_name) > 0) {
+        Shard shard;
+        shard.file_name = data_file_name;
+        shards.push_back(shard);
+    } else {
+        read_manifest(data_file_name);
+    }
+    // Every shard has to be opened once to learn its size unless the
+    // manifest lists it
+    int first = 0;
+    for (int i = 0; i < shards.size(); i++) {
+        if (i == 0 || shards[i].num_items < 0) {
+            open_shard(i);
+        }
+        shards[i].first = first;
+        first += shards[i].num_items;
+    }
+    data_shape[0] = first;
+    label_shape[0] = first;
+    debug("%d items in %lu shards", first, shards.size());
+}
+
+// A manifest is a text file listing the HDF5 files (shards) that make up
+// one logical dataset, one per line as "file_name [num_items]".  Items are
+// numbered across shards in the order they are listed.
+void Dataset::read_manifest(char* manifest_file_name) {
+    debug("Reading manifest %s.", manifest_file_name);
+    std::ifstream manifest(manifest_file_name);
+    if (!manifest) {
+        std::cerr << "Error: could not open dataset " << manifest_file_name << std::endl;
+        assert(false);
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line);
+        Shard shard;
+        if (!(fields >> shard.file_name)) continue;
+        if (!(fields >> shard.num_items)) shard.num_items = -1;
+        shards.push_back(shard);
+    }
+    if (shards.empty()) {
+        std::cerr << "Error: no shards listed in " << manifest_file_name << std::endl;
+        assert(false);
+    }
+}
+
+// Open shard s unless it is already open, closing the least recently used
+// shard first when max_open_files shards are open.  The caller holds
+// hdf5_mutex.
+Shard& Dataset::open_shard(int s) {
+    Shard& shard = shards[s];
+    shard.last_use = ++shard_clock;
+    if (shard.file_id != -1) {
+        return shard;
+    }
+    if (open_files >= max_open_files) {
+        int lru = -1;
+        for (int i = 0; i < shards.size(); i++) {
+            if (shards[i].file_id != -1 && (lru < 0 || shards[i].last_use < shards[lru].last_use)) {
+                lru = i;
+            }
+        }
+        close_shard(shards[lru]);
+    }
+    debug("Opening shard %d, %s.", s, shard.file_name.c_str());
 
     // Set up file access property list with parallel I/O access
     hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
     assert(plist_id != -1);
 
     herr_t ret;
-    if (use_mpi) {
-        debug("Rank %d : Setting up parallel access to dataset %s.", rank, data_file_name);
+    if (use_mpi && shards.size() == 1) {
 #ifdef LATTE_BUILD_MPI
+        debug("Setting up parallel access to dataset %s.", shard.file_name.c_str());
         /* set Parallel access with communicator */
         ret = H5Pset_fapl_mpio(plist_id, get_inter_net_comm(), MPI_INFO_NULL);
         assert(ret != -1);
@@ -62,23 +301,47 @@ Dataset::Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use
         assert(false);
 #endif
     } else {
-        debug("use_mpi=%d, accesing dataset %s in sequential mode.", use_mpi, data_file_name);
+        // Shards are opened by each rank on first use, which rules out the
+        // collective open of the MPI-IO driver
+        debug("use_mpi=%d, accesing dataset %s in sequential mode.", use_mpi, shard.file_name.c_str());
     }
-   
+
     // open file
-    file_id = H5Fopen(data_file_name, H5F_ACC_RDONLY, plist_id);
-    assert(file_id != -1);
+    shard.file_id = H5Fopen(shard.file_name.c_str(), H5F_ACC_RDONLY, plist_id);
+    if (shard.file_id < 0) {
+        std::cerr << "Error: could not open dataset " << shard.file_name << std::endl;
+        assert(false);
+    }
     ret = H5Pclose(plist_id);
     assert(ret != -1);
+    open_files++;
 
     // open dataset
-    label_dataset_id = H5Dopen2(file_id, "/label", H5P_DEFAULT);
-    assert(label_dataset_id != -1);
-    
-    data_dataset_id = H5Dopen2(file_id, "/data", H5P_DEFAULT);
-    assert(data_dataset_id != -1);
+    shard.label_dataset_id = H5Dopen2(shard.file_id, "/label", H5P_DEFAULT);
+    assert(shard.label_dataset_id != -1);
+
+    shard.data_dataset_id = H5Dopen2(shard.file_id, "/data", H5P_DEFAULT);
+    assert(shard.data_dataset_id != -1);
 
-    hid_t space_id = H5Dget_space(data_dataset_id);
+    int num_items = data_shape == NULL ? read_item_info(shard) : check_item_info(shard);
+    assert(shard.num_items < 0 || shard.num_items == num_items);
+    shard.num_items = num_items;
+    open_chunked(shard);
+    return shard;
+}
+
+void Dataset::close_shard(Shard& shard) {
+    H5Dclose(shard.data_dataset_id);
+    H5Dclose(shard.label_dataset_id);
+    H5Fclose(shard.file_id);
+    shard.file_id = -1;
+    open_files--;
+}
+
+// Read the item shapes and sample type of the dataset from its first shard,
+// returns the number of items of the shard
+int Dataset::read_item_info(Shard& shard) {
+    hid_t space_id = H5Dget_space(shard.data_dataset_id);
     assert(space_id != -1);
 
     data_ndim = H5Sget_simple_extent_ndims(space_id);
@@ -102,53 +365,32 @@ Dataset::Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use
         data_shape[i] = space_dims[i];
     }
 
-    num_total_items = data_shape[0];
-    if (use_mpi) { // && divide_by_rank) {
-#ifdef LATTE_BUILD_MPI
-        int size;
-        MPI_Comm_size(get_inter_net_comm(), &size);
-        int chunk_size = num_total_items / size + 1;
-        chunk_start = rank * chunk_size;
-        chunk_end = std::min(chunk_start+chunk_size, num_total_items);
-        num_total_items = chunk_end - chunk_start;
-        debug("Rank %d : chunk_size=%d, chunk_start=%d, chunk_end=%d, num_total_items=%d", rank, chunk_size, chunk_start, chunk_end, num_total_items);
-#endif
-    } else {
-        chunk_start = 0;
-        chunk_end = num_total_items;
+    hid_t type_id = H5Dget_type(shard.data_dataset_id);
+    data_type = sample_type_of(type_id);
+    H5Tclose(type_id);
+    if (data_type < 0) {
+        std::cerr << "Error: unsupported type for /data in " << shard.file_name
+                  << ", expected float32, float16 or uint8" << std::endl;
+        assert(false);
+    }
+    data_type_size = sample_type_size(data_type);
+    // Integer samples are stored unnormalized, the scale attribute (if
+    // present) maps them back to the range the network was trained with
+    data_scale = data_type == SAMPLE_UINT8 ? 1.0f / 255.0f : 1.0f;
+    if (H5Aexists(shard.data_dataset_id, "scale") > 0) {
+        hid_t attr_id = H5Aopen(shard.data_dataset_id, "scale", H5P_DEFAULT);
+        H5Aread(attr_id, H5T_NATIVE_FLOAT, &data_scale);
+        H5Aclose(attr_id);
     }
+    debug("data type %d, scale %f", data_type, data_scale);
+
     data_item_size = 1;
     for (int i = 1; i < data_ndim; i++) {
         data_item_size *= data_shape[i];
     }
-    debug("data_item_size %d", data_item_size);
-    debug("num_total_items %d", num_total_items);
-// #define LOCAL_SIZE 40000000000ul
-#define LOCAL_SIZE 2000000000ul
-    if (num_total_items > LOCAL_SIZE / (data_item_size*sizeof(float))) {
-        num_local_items = LOCAL_SIZE/(data_item_size*sizeof(float));
-        // make it a multiple of batch_size
-        num_local_items = (num_local_items/batch_size)*batch_size;
-    } else {
-        num_local_items = num_total_items;
-    }
-
-    // chunk_idx = chunk_start;
-    chunk_idx = 0;
-    n_chunks = num_total_items / num_local_items;
-    chunks = new int[n_chunks];
-    for (int i = 0; i < n_chunks; i++) {
-        chunks[i] = chunk_start + num_local_items * i;
-    }
-    if (shuffle) std::random_shuffle(chunks, chunks + n_chunks);
-
-    debug("num_local_items %d", num_local_items);
-    batch_idxs = new int[num_local_items];
-    for (int i = 0; i < num_local_items; i++) batch_idxs[i] = i;
-    data_buffer = new float[num_local_items*data_item_size];
+    H5Sclose(space_id);
 
-
-    space_id = H5Dget_space(label_dataset_id);
+    space_id = H5Dget_space(shard.label_dataset_id);
     assert(space_id != -1);
 
     label_ndim = H5Sget_simple_extent_ndims(space_id);
@@ -165,122 +407,1015 @@ Dataset::Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use
     for (int i = 1; i < label_ndim; i++) {
         label_item_size *= label_shape[i];
     }
-    label_buffer = new float[num_local_items*label_item_size];
-    fetch_next_chunk(true);
+    H5Sclose(space_id);
+    assert(label_shape[0] == data_shape[0]);
+    return data_shape[0];
 }
 
-void Dataset::fetch_next_chunk(bool force) {
-    // always shuffle batch_idxs
-    if (shuffle) std::random_shuffle(batch_idxs, batch_idxs + num_local_items);
-    // If dataset fits in memory we don't need to reload it
-    if (num_local_items != num_total_items || force) {
-        // Load the next local chunk
-        hsize_t count[data_ndim];
-        hsize_t start[data_ndim];
-        count[0] = num_local_items;
-        // start[0] = chunk_idx;
-        start[0] = chunks[chunk_idx];
-        debug("Fetching chunk %d", start[0]);
-        debug("chunk_idx: %d", chunk_idx);
-        debug("num_local_items: %d", num_local_items);
-        debug("count: ");
+// Check that the items of a shard match those of the first one, returns the
+// number of items of the shard
+int Dataset::check_item_info(Shard& shard) {
+    hid_t space_id = H5Dget_space(shard.data_dataset_id);
+    assert(space_id != -1);
+    hsize_t space_dims[data_ndim];
+    bool match = H5Sget_simple_extent_ndims(space_id) == data_ndim;
+    if (match) {
+        H5Sget_simple_extent_dims(space_id, space_dims, NULL);
         for (int i = 1; i < data_ndim; i++) {
-            count[i] = data_shape[i];
-            debug("  %d", data_shape[i]);
-            start[i] = 0;
-        }
-        /* create a file dataspace independently */
-        hid_t my_dataspace = H5Dget_space(data_dataset_id);
-        assert(my_dataspace != -1);
-        herr_t ret;
-        ret=H5Sselect_hyperslab(my_dataspace, H5S_SELECT_SET, start, NULL, count, NULL);
-        assert(ret != -1);
+            match = match && space_dims[i] == data_shape[i];
+        }
+    }
+    H5Sclose(space_id);
+    hid_t type_id = H5Dget_type(shard.data_dataset_id);
+    match = match && sample_type_of(type_id) == data_type;
+    H5Tclose(type_id);
+
+    space_id = H5Dget_space(shard.label_dataset_id);
+    assert(space_id != -1);
+    hsize_t label_space_dims[label_ndim];
+    match = match && H5Sget_simple_extent_ndims(space_id) == label_ndim;
+    if (match) {
+        H5Sget_simple_extent_dims(space_id, label_space_dims, NULL);
+        match = label_space_dims[0] == space_dims[0];
+        for (int i = 1; i < label_ndim; i++) {
+            match = match && label_space_dims[i] == label_shape[i];
+        }
+    }
+    H5Sclose(space_id);
+    if (!match) {
+        std::cerr << "Error: items of " << shard.file_name
+                  << " do not match those of the first shard" << std::endl;
+        assert(false);
+    }
+    return space_dims[0];
+}
+
+// Find out whether /data of a shard is chunked and how its chunks can be
+// read, sizes the chunk cache accordingly
+void Dataset::open_chunked(Shard& shard) {
+    hid_t dcpl = H5Dget_create_plist(shard.data_dataset_id);
+    assert(dcpl != -1);
+    if (H5Pget_layout(dcpl) == H5D_CHUNKED) {
+        hsize_t chunk_dims[data_ndim];
+        H5Pget_chunk(dcpl, data_ndim, chunk_dims);
+        shard.storage_chunk_items = chunk_dims[0];
+        shard.storage_chunk_bytes = (size_t) shard.storage_chunk_items * data_item_size * data_type_size;
+        // Chunks of whole items that are at most shuffled and deflated are
+        // read raw and inflated here, anything else goes through H5Dread
+        shard.direct_chunks = true;
+        for (int i = 1; i < data_ndim; i++) {
+            if (chunk_dims[i] != data_shape[i]) shard.direct_chunks = false;
+        }
+        int n_filters = H5Pget_nfilters(dcpl);
+        for (int i = 0; i < n_filters; i++) {
+            unsigned int flags, filter_config;
+            size_t n_values = 0;
+            H5Z_filter_t filter = H5Pget_filter2(dcpl, i, &flags, &n_values, NULL, 0, NULL, &filter_config);
+            if (filter == H5Z_FILTER_SHUFFLE && i == 0) {
+                shard.shuffle_filter = i;
+            } else if (filter == H5Z_FILTER_DEFLATE && shard.deflate_filter < 0) {
+                shard.deflate_filter = i;
+            } else {
+                shard.direct_chunks = false;
+            }
+        }
+        // Raw chunks hold the file type, it has to be the in-memory one
+        hid_t file_type = H5Dget_type(shard.data_dataset_id);
+        hid_t mem_type = sample_hdf5_type(data_type);
+        if (H5Tequal(file_type, mem_type) <= 0) shard.direct_chunks = false;
+        H5Tclose(mem_type);
+        H5Tclose(file_type);
 
-        /* create a memory dataspace independently */
-        hid_t mem_dataspace = H5Screate_simple (data_ndim, count, NULL);
-        assert (mem_dataspace != -1);
-
-        hid_t xfer_plist = H5Pcreate (H5P_DATASET_XFER);
-        assert(xfer_plist != -1);
-//         if (use_mpi) {
-// #ifdef LATTE_BUILD_MPI
-//             ret = H5Pset_dxpl_mpio(xfer_plist, H5FD_MPIO_COLLECTIVE);
-//             assert(ret != -1);
-// #endif
-//         }
-
-        /* read data collectively */
-        ret = H5Dread(data_dataset_id, H5T_NATIVE_FLOAT, mem_dataspace, my_dataspace,
-                xfer_plist, data_buffer);
-        // printf("Error %d", ret);
+        // Direct reads bypass the chunk cache.  Otherwise make room for a few
+        // chunks, the 1MB default is smaller than most chunks of images and
+        // HDF5 then rereads and reinflates a chunk every time it is touched.
+        hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        assert(dapl != -1);
+        size_t cache_bytes = shard.direct_chunks ? 0 :
+                             std::max(4 * shard.storage_chunk_bytes, (size_t) 1 << 20);
+        herr_t ret = H5Pset_chunk_cache(dapl, 521, cache_bytes, 1.0);
         assert(ret != -1);
+        H5Dclose(shard.data_dataset_id);
+        shard.data_dataset_id = H5Dopen2(shard.file_id, "/data", dapl);
+        assert(shard.data_dataset_id != -1);
+        H5Pclose(dapl);
+        debug("chunked data, %d items per chunk, direct reads %d", shard.storage_chunk_items,
+              shard.direct_chunks);
+    }
+    H5Pclose(dcpl);
+}
 
-        count[0] = num_local_items;
-        // start[0] = chunk_idx;
-        start[0] = chunks[chunk_idx];
-        for (int i = 1; i < label_ndim; i++) {
-            count[i] = label_shape[i];
-            start[i] = 0;
+void Dataset::open_raw(char* data_file_name) {
+    debug("Mapping raw dataset %s.", data_file_name);
+    int fd = open(data_file_name, O_RDONLY);
+    assert(fd != -1);
+    RawHeader header;
+    ssize_t n = pread(fd, &header, sizeof(RawHeader), 0);
+    assert(n == sizeof(RawHeader));
+    assert(header.version == LATTE_RAW_VERSION);
+    assert(sample_type_size(header.data_type) != 0);
+    assert(header.data_ndim > 2 && header.data_ndim <= LATTE_RAW_MAX_NDIM);
+    assert(header.label_ndim > 1 && header.label_ndim <= LATTE_RAW_MAX_NDIM);
+
+    struct stat st;
+    fstat(fd, &st);
+    assert((uint64_t) st.st_size >= header.file_size);
+    map_length = header.file_size;
+    // Map shared so the page cache is reused across training processes
+    map_base = (char*) mmap(NULL, map_length, PROT_READ, MAP_SHARED, fd, 0);
+    assert(map_base != MAP_FAILED);
+    close(fd);
+
+    data_ndim = header.data_ndim;
+    data_shape = new int[data_ndim];
+    data_item_size = 1;
+    for (int i = 0; i < data_ndim; i++) {
+        data_shape[i] = header.data_shape[i];
+        if (i > 0) data_item_size *= data_shape[i];
+    }
+    label_ndim = header.label_ndim;
+    label_shape = new int[label_ndim];
+    label_item_size = 1;
+    for (int i = 0; i < label_ndim; i++) {
+        label_shape[i] = header.label_shape[i];
+        if (i > 0) label_item_size *= label_shape[i];
+    }
+    assert(label_shape[0] == data_shape[0]);
+    data_type = header.data_type;
+    data_type_size = sample_type_size(data_type);
+    data_scale = header.data_scale;
+    data_buffer = map_base + header.data_offset;
+    label_buffer = (float*) (map_base + header.label_offset);
+}
+
+Dataset::~Dataset() {
+    finish_prefetch();
+    stop_stream();
+    if (streaming) {
+        // data_buffer, label_buffer and batch_idxs point into a batch
+        for (int i = 0; i < stream_batches.size(); i++) {
+            buffer_arena.release(stream_batches[i].data);
+            buffer_arena.release(stream_batches[i].label);
+            buffer_arena.release(stream_batches[i].idxs);
+        }
+    } else {
+        buffer_arena.release(batch_idxs);
+        if (map_base == NULL) {
+            buffer_arena.release(data_buffer);
+            buffer_arena.release(label_buffer);
+        }
+    }
+    buffer_arena.release(next_data_buffer);
+    buffer_arena.release(next_label_buffer);
+    for (int i = 1; i < replicas.size(); i++) {
+        buffer_arena.release(replicas[i]);
+        buffer_arena.release(next_replicas[i]);
+    }
+    delete[] chunks;
+    if (out_shape != data_shape) delete[] out_shape;
+    delete[] data_shape;
+    delete[] label_shape;
+    delete[] transform.mean;
+    delete[] crop_y;
+    delete[] crop_x;
+    delete[] flip;
+    if (map_base != NULL) {
+        munmap(map_base, map_length);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(hdf5_mutex);
+    for (int i = 0; i < shards.size(); i++) {
+        if (shards[i].file_id != -1) {
+            close_shard(shards[i]);
+        }
+    }
+}
+
+// Index of the shard holding item row
+int Dataset::find_shard(int row) {
+    int lo = 0, hi = shards.size() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (shards[mid].first <= row) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
         }
+    }
+    return lo;
+}
+
+// Split the slabs starting at window[0, slabs_per_window) into pieces that
+// each lie in one shard, ordered by item
+std::vector<WindowPiece> Dataset::window_pieces(const int* window) {
+    // HDF5 lands the selection in memory in file order regardless, and
+    // OR-ing adjacent hyperslabs out of order trips up its span merging
+    std::vector<int> slabs(window, window + slabs_per_window);
+    std::sort(slabs.begin(), slabs.end());
+    std::vector<WindowPiece> pieces;
+    for (int i = 0; i < slabs_per_window; i++) {
+        int row = slabs[i];
+        int slab_end = slabs[i] + slab_size;
+        int s = find_shard(row);
+        while (row < slab_end) {
+            while (row >= shards[s].first + shards[s].num_items) s++;
+            WindowPiece piece;
+            piece.shard = s;
+            piece.start = row - shards[s].first;
+            piece.count = std::min(slab_end, shards[s].first + shards[s].num_items) - row;
+            piece.dst = i * slab_size + row - slabs[i];
+            pieces.push_back(piece);
+            row += piece.count;
+        }
+    }
+    return pieces;
+}
 
-        /* create a file dataspace independently */
-        my_dataspace = H5Dget_space(label_dataset_id);
-        mem_dataspace = H5Screate_simple(label_ndim, count, NULL);
-        assert(my_dataspace != -1);
+// Read pieces [begin, end), which all lie in the shard dataset belongs to,
+// into the window at dst
+void Dataset::read_pieces(hid_t dataset, hid_t mem_type, int ndim, int* shape,
+                          const std::vector<WindowPiece>& pieces, int begin, int end,
+                          hid_t xfer_plist, void* dst) {
+    hsize_t count[ndim];
+    hsize_t start[ndim];
+    count[0] = num_local_items;
+    for (int i = 1; i < ndim; i++) {
+        count[i] = shape[i];
+        start[i] = 0;
+    }
+    /* create a memory dataspace independently */
+    hid_t mem_dataspace = H5Screate_simple(ndim, count, NULL);
+    assert(mem_dataspace != -1);
+    /* create a file dataspace independently */
+    hid_t my_dataspace = H5Dget_space(dataset);
+    assert(my_dataspace != -1);
+    H5Sselect_none(my_dataspace);
+    H5Sselect_none(mem_dataspace);
+    for (int i = begin; i < end; i++) {
+        count[0] = pieces[i].count;
         // stride and block are NULL for contiguous hyperslab
-        ret = H5Sselect_hyperslab(my_dataspace, H5S_SELECT_SET, start, NULL, count, NULL);
+        start[0] = pieces[i].start;
+        herr_t ret = H5Sselect_hyperslab(my_dataspace, H5S_SELECT_OR, start, NULL, count, NULL);
+        assert(ret != -1);
+        start[0] = pieces[i].dst;
+        ret = H5Sselect_hyperslab(mem_dataspace, H5S_SELECT_OR, start, NULL, count, NULL);
         assert(ret != -1);
+    }
+    herr_t ret = H5Dread(dataset, mem_type, mem_dataspace, my_dataspace, xfer_plist, dst);
+    // printf("Error %d", ret);
+    assert(ret != -1);
+    H5Sclose(my_dataspace);
+    H5Sclose(mem_dataspace);
+}
 
-        ret = H5Dread(label_dataset_id, H5T_NATIVE_FLOAT, mem_dataspace, my_dataspace,
-                xfer_plist, label_buffer);
-        H5Pclose(xfer_plist);
+void Dataset::read_window(int first_slab, char* data_dst, float* label_dst) {
+    std::unique_lock<std::mutex> lock(hdf5_mutex);
+    debug("Fetching %d slabs starting with slab %d", slabs_per_window, chunks[chunk_offset + first_slab]);
+    read_items(window_pieces(chunks + chunk_offset + first_slab), data_dst, label_dst, lock);
+}
+
+// Read pieces, ordered by item, into data_dst and label_dst.  lock holds
+// hdf5_mutex and is released once the HDF5 reads are done.
+void Dataset::read_items(const std::vector<WindowPiece>& pieces, char* data_dst, float* label_dst,
+                         std::unique_lock<std::mutex>& lock) {
+    double start_time = omp_get_wtime();
+    hid_t xfer_plist = H5Pcreate (H5P_DATASET_XFER);
+    assert(xfer_plist != -1);
+    if (collective) {
+#ifdef LATTE_BUILD_MPI
+        // Every rank reads its window in the same call so MPI-IO can
+        // aggregate the slabs into large contiguous file accesses
+        herr_t ret = H5Pset_dxpl_mpio(xfer_plist, H5FD_MPIO_COLLECTIVE);
         assert(ret != -1);
-        if (chunk_idx + 1 >= n_chunks) {
-            chunk_idx = 0;
-        // if (chunk_idx + 2 * num_local_items > chunk_end) {
-            // chunk_idx = chunk_start;
-            epoch += 1;
-            if (shuffle) std::random_shuffle(chunks, chunks + n_chunks);
+#endif
+    }
+
+    // samples stay in their stored type
+    hid_t mem_type = sample_hdf5_type(data_type);
+    stored_chunks.clear();
+    // One read per shard of all its pieces
+    for (int begin = 0, end; begin < pieces.size(); begin = end) {
+        end = begin + 1;
+        while (end < pieces.size() && pieces[end].shard == pieces[begin].shard) end++;
+        Shard& shard = open_shard(pieces[begin].shard);
+        if (shard.direct_chunks) {
+            read_stored_chunks(pieces, begin, end);
+        } else {
+            read_pieces(shard.data_dataset_id, mem_type, data_ndim, data_shape, pieces, begin, end,
+                        xfer_plist, data_dst);
+        }
+        read_pieces(shard.label_dataset_id, H5T_NATIVE_FLOAT, label_ndim, label_shape, pieces,
+                    begin, end, xfer_plist, label_dst);
+    }
+    H5Tclose(mem_type);
+    H5Pclose(xfer_plist);
+    lock.unlock();
+
+    if (!stored_chunks.empty()) {
+        inflate_chunks(data_dst);
+    }
+    size_t num_items = 0;
+    for (int i = 0; i < pieces.size(); i++) num_items += pieces[i].count;
+    stats.add(IO_BYTES_READ, num_items * (data_item_size * data_type_size + label_item_size * sizeof(float)));
+    stats.add(IO_ITEMS_READ, num_items);
+    stats.add(IO_READS, 1);
+    stats.add_time(IO_READ, omp_get_wtime() - start_time);
+}
+
+// Read the raw storage chunks covering pieces [begin, end), which all lie in
+// one shard, into compressed_buffer.  The caller holds hdf5_mutex.
+void Dataset::read_stored_chunks(const std::vector<WindowPiece>& pieces, int begin, int end) {
+    Shard& shard = shards[pieces[begin].shard];
+    hsize_t offset[data_ndim];
+    for (int i = 1; i < data_ndim; i++) {
+        offset[i] = 0;
+    }
+    int first_chunk = stored_chunks.size();
+    size_t total_size = first_chunk == 0 ? 0 :
+                        stored_chunks.back().offset + stored_chunks.back().size;
+    for (int i = begin; i < end; i++) {
+        int piece_end = pieces[i].start + pieces[i].count;
+        int row = pieces[i].start - pieces[i].start % shard.storage_chunk_items;
+        for (; row < piece_end; row += shard.storage_chunk_items) {
+            StoredChunk chunk;
+            chunk.shard = pieces[i].shard;
+            chunk.row = row;
+            chunk.first = std::max(pieces[i].start, row) - row;
+            chunk.last = std::min(piece_end, row + shard.storage_chunk_items) - row;
+            chunk.dst = pieces[i].dst + row + chunk.first - pieces[i].start;
+            offset[0] = row;
+            hsize_t size;
+            herr_t ret = H5Dget_chunk_storage_size(shard.data_dataset_id, offset, &size);
+            assert(ret != -1);
+            if (size == 0) {
+                std::cerr << "Error: storage chunk at item " << row << " of " << shard.file_name
+                          << " was never written" << std::endl;
+                assert(false);
+            }
+            chunk.offset = total_size;
+            chunk.size = size;
+            total_size += size;
+            stored_chunks.push_back(chunk);
+        }
+    }
+    if (compressed_buffer.size() < total_size) {
+        compressed_buffer.resize(total_size);
+    }
+    for (int i = first_chunk; i < stored_chunks.size(); i++) {
+        StoredChunk& chunk = stored_chunks[i];
+        offset[0] = chunk.row;
+        herr_t ret = H5Dread_chunk(shard.data_dataset_id, H5P_DEFAULT, offset, &chunk.filter_mask,
+                                   compressed_buffer.data() + chunk.offset);
+        assert(ret != -1);
+    }
+}
+
+// Undo the HDF5 shuffle filter, which stores byte j of the i-th of n
+// elements at src[j * n + i]
+static void unshuffle_bytes(char* dst, const char* src, size_t bytes, size_t elem_size) {
+    size_t n = bytes / elem_size;
+    for (size_t j = 0; j < elem_size; j++) {
+        for (size_t i = 0; i < n; i++) {
+            dst[i * elem_size + j] = src[j * n + i];
+        }
+    }
+    size_t rest = n * elem_size;
+    memcpy(dst + rest, src + rest, bytes - rest);
+}
+
+// Inflate the chunks read by read_stored_chunks into their place in data_dst
+void Dataset::inflate_chunks(char* data_dst) {
+    size_t item_bytes = (size_t) data_item_size * data_type_size;
+    #pragma omp parallel
+    {
+        // Chunks only partially in the window are inflated to scratch first
+        std::vector<char> inflated, unshuffled;
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < (int) stored_chunks.size(); i++) {
+            const StoredChunk& chunk = stored_chunks[i];
+            const Shard& shard = shards[chunk.shard];
+            const char* src = compressed_buffer.data() + chunk.offset;
+            char* dst = data_dst + chunk.dst * item_bytes;
+            bool whole = chunk.first == 0 && chunk.last == shard.storage_chunk_items;
+            bool deflated = shard.deflate_filter >= 0 && !(chunk.filter_mask & (1u << shard.deflate_filter));
+            bool shuffled = shard.shuffle_filter >= 0 && !(chunk.filter_mask & (1u << shard.shuffle_filter)) &&
+                            data_type_size > 1;
+            if (deflated) {
+                char* out = dst;
+                if (!whole || shuffled) {
+                    inflated.resize(shard.storage_chunk_bytes);
+                    out = inflated.data();
+                }
+                uLongf out_size = shard.storage_chunk_bytes;
+                int ret = uncompress((Bytef*) out, &out_size, (const Bytef*) src, chunk.size);
+                if (ret != Z_OK || out_size != shard.storage_chunk_bytes) {
+                    std::cerr << "Error: could not inflate storage chunk at item " << chunk.row
+                              << " (zlib error " << ret << ")" << std::endl;
+                    assert(false);
+                }
+                src = out;
+            } else {
+                assert(chunk.size == shard.storage_chunk_bytes);
+            }
+            if (shuffled) {
+                char* out = dst;
+                if (!whole) {
+                    unshuffled.resize(shard.storage_chunk_bytes);
+                    out = unshuffled.data();
+                }
+                unshuffle_bytes(out, src, shard.storage_chunk_bytes, data_type_size);
+                src = out;
+            }
+            if (src != dst) {
+                memcpy(dst, src + chunk.first * item_bytes, (chunk.last - chunk.first) * item_bytes);
+            }
+        }
+    }
+}
+
+void Dataset::shuffle_chunks() {
+    double start_time = omp_get_wtime();
+    if (collective) {
+        // Identical on every rank, reassigns slabs to ranks
+        std::shuffle(chunks, chunks + n_total_chunks, slab_rng);
+    } else if (shuffle) {
+        std::shuffle(chunks, chunks + n_total_chunks, rng);
+    }
+    stats.add_time(IO_SHUFFLE, omp_get_wtime() - start_time);
+}
+
+void Dataset::advance_chunk() {
+    if (chunk_idx + 2 * slabs_per_window > n_chunks) {
+        chunk_idx = 0;
+        epoch += 1;
+        shuffle_chunks();
+    } else {
+        chunk_idx += slabs_per_window;
+    }
+}
+
+bool Dataset::background_reads_allowed(const char* feature) {
+#ifdef LATTE_BUILD_MPI
+    // A single file is opened through the MPI-IO driver, whose reads are MPI
+    // calls overlapping those made by the compute threads
+    if (use_mpi && shards.size() == 1 && map_base == NULL) {
+        int provided;
+        MPI_Query_thread(&provided);
+        if (provided != MPI_THREAD_MULTIPLE) {
+            std::cerr << "Warning: " << feature << " reads through MPI-IO on a background thread "
+                      << "and requires MPI_THREAD_MULTIPLE (set LATTE_MPI_THREADS=multiple), "
+                      << feature << " disabled" << std::endl;
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+// Begin reading the window at chunk_idx into the back buffers on a background
+// thread
+void Dataset::start_prefetch() {
+    assert(!prefetch_pending);
+    prefetch_pending = true;
+    prefetch_thread = std::thread(&Dataset::prefetch_window, this, chunk_idx);
+}
+
+// Body of the prefetch thread, the replicas are copied here too so that
+// switching to the window is only a swap.  The copy is serial to stay out
+// of the way of the gather threads.
+void Dataset::prefetch_window(int first_slab) {
+    read_window(first_slab, next_data_buffer, next_label_buffer);
+    replicate_window(next_data_buffer, next_replicas, false);
+}
+
+void Dataset::finish_prefetch() {
+    if (prefetch_pending) {
+        prefetch_thread.join();
+        prefetch_pending = false;
+    }
+}
+
+void Dataset::set_prefetch(bool enable) {
+    // Prefetching only helps when the dataset does not fit in a single chunk,
+    // streaming datasets always read ahead
+    if (num_local_items == num_total_items && !collective) return;
+    if (streaming) return;
+    if (enable && !background_reads_allowed("prefetch")) return;
+    if (enable && !prefetch) {
+        prefetch = true;
+        // A suspended dataset starts prefetching once it is resumed
+        if (!suspended) {
+            next_data_buffer = acquire_window();
+            next_label_buffer = buffer_arena.acquire<float>((size_t) num_local_items*label_item_size);
+            start_prefetch();
+        }
+    } else if (!enable && prefetch) {
+        // chunk_idx has not been advanced for the pending chunk, the next
+        // fetch will simply read it again synchronously
+        finish_prefetch();
+        prefetch = false;
+        buffer_arena.release(next_data_buffer);
+        buffer_arena.release(next_label_buffer);
+        next_data_buffer = NULL;
+        next_label_buffer = NULL;
+        for (int i = 1; i < next_replicas.size(); i++) {
+            buffer_arena.release(next_replicas[i]);
+            next_replicas[i] = NULL;
+        }
+    }
+}
+
+void Dataset::fetch_next_chunk(bool force) {
+    // always shuffle batch_idxs
+    if (shuffle) {
+        double start_time = omp_get_wtime();
+        std::shuffle(batch_idxs, batch_idxs + num_local_items, rng);
+        stats.add_time(IO_SHUFFLE, omp_get_wtime() - start_time);
+    }
+    // If dataset fits in memory we don't need to reload it
+    if (num_local_items != num_total_items || collective || force) {
+        debug("chunk_idx: %d", chunk_idx);
+        int* window = chunks + chunk_offset + chunk_idx;
+        window_starts.assign(window, window + slabs_per_window);
+        double start_time = omp_get_wtime();
+        if (suspended) {
+            // resume reads the window
+        } else if (prefetch && prefetch_pending) {
+            // The next chunk has been (or is being) read in the background,
+            // switching chunks is a pointer swap
+            finish_prefetch();
+            std::swap(data_buffer, next_data_buffer);
+            std::swap(label_buffer, next_label_buffer);
+            std::swap(replicas, next_replicas);
+            stats.add_time(IO_STALL, omp_get_wtime() - start_time);
         } else {
-            // chunk_idx += num_local_items;
-            chunk_idx++;
+            read_window(chunk_idx, data_buffer, label_buffer);
+            replicate_window(data_buffer, replicas, true);
+            stats.add_time(IO_STALL, omp_get_wtime() - start_time);
         }
-        H5Sclose(my_dataspace);
-        H5Sclose(mem_dataspace);
+        advance_chunk();
+        if (prefetch) start_prefetch();
     } else {
         // Data fits in memory, don't need to reload it
         epoch += 1;
     }
 }
 
+// Start the thread that reads streamed batches into read_ahead slots
+void Dataset::start_stream(int read_ahead) {
+    stream_order.resize(num_total_items);
+    stream_seed = rng();
+    stream_pos = 0;
+    stream_epoch = 0;
+    next_stream_pos = 0;
+    next_stream_epoch = 0;
+    draw_stream_order();
+    stream_stopping = false;
+    stream_batches.resize(read_ahead);
+    for (int i = 0; i < read_ahead; i++) {
+        StreamBatch& batch = stream_batches[i];
+        batch.data = buffer_arena.acquire<char>((size_t) batch_size*data_item_size*data_type_size);
+        batch.label = buffer_arena.acquire<float>((size_t) batch_size*label_item_size);
+        batch.idxs = buffer_arena.acquire<int>(batch_size);
+        batch.epoch = 0;
+        batch.end_pos = 0;
+        stream_free.push_back(i);
+    }
+    stream_thread = std::thread(&Dataset::run_stream, this);
+}
+
+// The permutation of stream_epoch, a function of the epoch alone so that a
+// restored stream draws the same permutations
+void Dataset::draw_stream_order() {
+    for (int i = 0; i < num_total_items; i++) stream_order[i] = chunk_start + i;
+    if (shuffle) {
+        double start_time = omp_get_wtime();
+        std::seed_seq seq{stream_seed, (unsigned int) stream_epoch};
+        std::mt19937 order_rng(seq);
+        std::shuffle(stream_order.begin(), stream_order.end(), order_rng);
+        stats.add_time(IO_SHUFFLE, omp_get_wtime() - start_time);
+    }
+}
+
+void Dataset::stop_stream() {
+    if (!streaming || !stream_thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        stream_stopping = true;
+    }
+    stream_cond.notify_all();
+    stream_thread.join();
+}
+
+void Dataset::run_stream() {
+    while (true) {
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(stream_mutex);
+            while (stream_free.empty() && !stream_stopping) stream_cond.wait(lock);
+            if (stream_stopping) return;
+            slot = stream_free.front();
+            stream_free.pop_front();
+        }
+        read_stream_batch(stream_batches[slot]);
+        {
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            stream_ready.push_back(slot);
+        }
+        stream_cond.notify_all();
+    }
+}
+
+// Read the next batch_size items of the permutation into batch, drawing a
+// new permutation when the current one runs out
+void Dataset::read_stream_batch(StreamBatch& batch) {
+    // (item, position in the batch) sorted by item
+    std::vector<std::pair<int, int> > items(batch_size);
+    for (int i = 0; i < batch_size; i++) {
+        if (stream_pos == num_total_items) {
+            stream_pos = 0;
+            stream_epoch += 1;
+            draw_stream_order();
+        }
+        items[i] = std::make_pair(stream_order[stream_pos++], i);
+    }
+    batch.epoch = stream_epoch;
+    batch.end_pos = stream_pos;
+    std::sort(items.begin(), items.end());
+
+    // Runs of consecutive items within a shard are read as one piece, an
+    // item drawn twice (only when the dataset is smaller than a batch) is
+    // read once
+    std::vector<WindowPiece> pieces;
+    int n_read = 0;
+    for (int i = 0; i < batch_size; i++) {
+        int row = items[i].first;
+        if (i > 0 && row == items[i-1].first) {
+            batch.idxs[items[i].second] = n_read - 1;
+            continue;
+        }
+        batch.idxs[items[i].second] = n_read;
+        WindowPiece* last = pieces.empty() ? NULL : &pieces.back();
+        if (last != NULL && row == items[i-1].first + 1 &&
+                last->start + last->count < shards[last->shard].num_items) {
+            last->count++;
+        } else {
+            WindowPiece piece;
+            piece.shard = find_shard(row);
+            piece.start = row - shards[piece.shard].first;
+            piece.count = 1;
+            piece.dst = n_read;
+            pieces.push_back(piece);
+        }
+        n_read++;
+    }
+    debug("Streaming %d items in %lu pieces", n_read, pieces.size());
+    std::unique_lock<std::mutex> lock(hdf5_mutex);
+    read_items(pieces, batch.data, batch.label, lock);
+}
+
+// Wait for the oldest streamed batch and gather from it, returns its slot
+int Dataset::acquire_stream_batch() {
+    double start_time = omp_get_wtime();
+    std::unique_lock<std::mutex> lock(stream_mutex);
+    while (stream_ready.empty()) stream_cond.wait(lock);
+    stats.add_time(IO_STALL, omp_get_wtime() - start_time);
+    int slot = stream_ready.front();
+    stream_ready.pop_front();
+    StreamBatch& batch = stream_batches[slot];
+    data_buffer = batch.data;
+    label_buffer = batch.label;
+    batch_idxs = batch.idxs;
+    epoch = batch.epoch;
+    next_stream_epoch = batch.epoch;
+    next_stream_pos = batch.end_pos;
+    return slot;
+}
+
+void Dataset::release_stream_batch(int slot) {
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        stream_free.push_back(slot);
+    }
+    stream_cond.notify_all();
+}
+
+void Dataset::set_transform(char* mean_file_name, float scale, int crop_height, int crop_width,
+                            bool random_crop, bool mirror) {
+    bool has_mean = mean_file_name != NULL && mean_file_name[0] != '\0';
+    transform.scale = scale;
+    if (!has_mean && crop_height <= 0 && crop_width <= 0 && !mirror) {
+        return;
+    }
+    if (data_ndim != 4) {
+        std::cerr << "Error: transforms require (N, C, H, W) data" << std::endl;
+        assert(false);
+    }
+    if (crop_height <= 0) crop_height = data_shape[2];
+    if (crop_width <= 0) crop_width = data_shape[3];
+    assert(crop_height <= data_shape[2] && crop_width <= data_shape[3]);
+    transform.enabled = true;
+    transform.crop_height = crop_height;
+    transform.crop_width = crop_width;
+    transform.random_crop = random_crop;
+    transform.mirror = mirror;
+
+    delete[] transform.mean;
+    transform.mean = NULL;
+    if (has_mean) {
+        // Mean file as written by utils/converter, a /mean dataset with the
+        // shape of one stored item
+        std::lock_guard<std::mutex> lock(hdf5_mutex);
+        hid_t mean_file_id = H5Fopen(mean_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+        assert(mean_file_id != -1);
+        hid_t mean_id = H5Dopen2(mean_file_id, "/mean", H5P_DEFAULT);
+        assert(mean_id != -1);
+        hid_t space_id = H5Dget_space(mean_id);
+        assert(H5Sget_simple_extent_npoints(space_id) == data_item_size);
+        H5Sclose(space_id);
+        transform.mean = new float[data_item_size];
+        herr_t ret = H5Dread(mean_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                             transform.mean);
+        assert(ret != -1);
+        H5Dclose(mean_id);
+        H5Fclose(mean_file_id);
+    }
+
+    if (out_shape == data_shape) out_shape = new int[data_ndim];
+    out_shape[0] = data_shape[0];
+    out_shape[1] = data_shape[1];
+    out_shape[2] = crop_height;
+    out_shape[3] = crop_width;
+    out_item_size = data_shape[1] * crop_height * crop_width;
+    if (crop_y == NULL) {
+        crop_y = new int[batch_size];
+        crop_x = new int[batch_size];
+        flip = new bool[batch_size];
+    }
+}
+
+// Choose the crop offsets and mirroring for every item of the next batch
+void Dataset::draw_transforms() {
+    int max_y = data_shape[2] - transform.crop_height;
+    int max_x = data_shape[3] - transform.crop_width;
+    for (int i = 0; i < batch_size; i++) {
+        if (transform.random_crop) {
+            crop_y[i] = rng() % (max_y + 1);
+            crop_x[i] = rng() % (max_x + 1);
+        } else {
+            crop_y[i] = max_y / 2;
+            crop_x[i] = max_x / 2;
+        }
+        flip[i] = transform.mirror && (rng() & 1);
+    }
+}
+
+// Widen, mean subtract, scale, crop and mirror window item src into position
+// dst of the output batch, one output row at a time
+void Dataset::transform_item(int dst, int src, const char* data) {
+    int channels = data_shape[1];
+    int height = data_shape[2];
+    int width = data_shape[3];
+    int crop_height = transform.crop_height;
+    int crop_width = transform.crop_width;
+    const char* item = data + (size_t) src*data_item_size*data_type_size;
+    float* out = data_out + (size_t) dst*out_item_size;
+    for (int c = 0; c < channels; c++) {
+        for (int y = 0; y < crop_height; y++) {
+            size_t offset = ((size_t) c*height + y + crop_y[dst])*width + crop_x[dst];
+            float* row = out + ((size_t) c*crop_height + y)*crop_width;
+            widen_samples(row, item + offset*data_type_size, crop_width, data_type, data_scale);
+            if (transform.mean != NULL) {
+                const float* mean_row = transform.mean + offset;
+#pragma omp simd
+                for (int x = 0; x < crop_width; x++) {
+                    row[x] -= mean_row[x];
+                }
+            }
+            if (transform.scale != 1.0f) {
+                float scale = transform.scale;
+#pragma omp simd
+                for (int x = 0; x < crop_width; x++) {
+                    row[x] *= scale;
+                }
+            }
+            if (flip[dst]) std::reverse(row, row + crop_width);
+        }
+    }
+    memcpy(label_out + (size_t) dst*label_item_size, label_buffer + (size_t) src*label_item_size,
+           label_item_size*sizeof(float));
+}
+
+// Copy window item src into position dst of the output batch, data is the
+// window or the calling thread's replica of it
+inline void Dataset::copy_item(int dst, int src, const char* data) {
+    if (transform.enabled) {
+        transform_item(dst, src, data);
+        return;
+    }
+    widen_samples(data_out + (size_t) dst*data_item_size,
+                  data + (size_t) src*data_item_size*data_type_size,
+                  data_item_size, data_type, data_scale*transform.scale);
+    memcpy(label_out + (size_t) dst*label_item_size, label_buffer + (size_t) src*label_item_size,
+           label_item_size*sizeof(float));
+}
+
+// Give the window back to buffer_arena until the next get_next_batch, which
+// reads it again.  Only datasets opened with share_buffers are suspended.
+void Dataset::suspend() {
+    if (!share_buffers || suspended) return;
+    // A window being prefetched is read again once resumed
+    finish_prefetch();
+    buffer_arena.release(data_buffer);
+    buffer_arena.release(label_buffer);
+    buffer_arena.release(next_data_buffer);
+    buffer_arena.release(next_label_buffer);
+    for (int i = 1; i < replicas.size(); i++) {
+        buffer_arena.release(replicas[i]);
+        buffer_arena.release(next_replicas[i]);
+        replicas[i] = NULL;
+        next_replicas[i] = NULL;
+    }
+    data_buffer = NULL;
+    label_buffer = NULL;
+    next_data_buffer = NULL;
+    next_label_buffer = NULL;
+    suspended = true;
+}
+
+// Everything that decides the items of the next batches, as text: the
+// cursor, the permutations of slabs and items, the RNG states and the slabs
+// of the current window.  Streaming datasets only need the position of the
+// next batch in the permutation of its epoch.
+std::string Dataset::save_state() {
+    std::ostringstream state;
+    state << DATASET_STATE_VERSION << ' ' << num_total_items << ' ' << num_local_items << ' '
+          << streaming << '\n';
+    state << epoch << ' ' << rng << '\n';
+    if (streaming) {
+        state << stream_seed << ' ' << next_stream_epoch << ' ' << next_stream_pos << '\n';
+        return state.str();
+    }
+    state << curr_item << ' ' << chunk_idx << ' ' << n_total_chunks << ' ' << slabs_per_window << '\n';
+    for (int i = 0; i < n_total_chunks; i++) state << chunks[i] << ' ';
+    state << '\n';
+    for (int i = 0; i < num_local_items; i++) state << batch_idxs[i] << ' ';
+    state << '\n';
+    // Mapped files never read a window
+    state << window_starts.size();
+    for (int i = 0; i < window_starts.size(); i++) state << ' ' << window_starts[i];
+    state << '\n' << slab_rng << '\n';
+    return state.str();
+}
+
+// Continue from a state saved by a dataset opened with the same file, batch
+// size and options.  Only the window the state resumes in is read, by the
+// next get_next_batch unless the window is read collectively.
+void Dataset::restore_state(const std::string& saved) {
+    std::istringstream state(saved);
+    int version, saved_total_items, saved_local_items;
+    bool saved_streaming;
+    state >> version >> saved_total_items >> saved_local_items >> saved_streaming;
+    if (!state || version != DATASET_STATE_VERSION || saved_total_items != num_total_items ||
+            saved_local_items != num_local_items || saved_streaming != streaming) {
+        std::cerr << "Error: saved state does not match the dataset" << std::endl;
+        assert(false);
+    }
+    state >> epoch >> rng;
+    if (streaming) {
+        stop_stream();
+        state >> stream_seed >> next_stream_epoch >> next_stream_pos;
+        stream_epoch = next_stream_epoch;
+        stream_pos = next_stream_pos;
+        draw_stream_order();
+        stream_ready.clear();
+        stream_free.clear();
+        for (int i = 0; i < stream_batches.size(); i++) stream_free.push_back(i);
+        stream_stopping = false;
+        stream_thread = std::thread(&Dataset::run_stream, this);
+        return;
+    }
+    // The window being prefetched is from the old cursor
+    finish_prefetch();
+    int saved_total_chunks, saved_slabs_per_window;
+    state >> curr_item >> chunk_idx >> saved_total_chunks >> saved_slabs_per_window;
+    if (saved_total_chunks != n_total_chunks || saved_slabs_per_window != slabs_per_window) {
+        std::cerr << "Error: saved state does not match the dataset" << std::endl;
+        assert(false);
+    }
+    for (int i = 0; i < n_total_chunks; i++) state >> chunks[i];
+    for (int i = 0; i < num_local_items; i++) state >> batch_idxs[i];
+    size_t num_window_starts;
+    state >> num_window_starts;
+    window_starts.resize(num_window_starts);
+    for (int i = 0; i < num_window_starts; i++) state >> window_starts[i];
+    state >> slab_rng;
+    assert(state);
+    if (!suspended && map_base == NULL) {
+        std::unique_lock<std::mutex> lock(hdf5_mutex);
+        read_items(window_pieces(&window_starts[0]), data_buffer, label_buffer, lock);
+        replicate_window(data_buffer, replicas, true);
+        if (prefetch) start_prefetch();
+    }
+}
+
+// Window sized buffer for samples, on node 0 when the window is replicated
+// and interleaved over the nodes otherwise
+char* Dataset::acquire_window() {
+    return buffer_arena.acquire<char>((size_t) num_local_items*data_item_size*data_type_size,
+                                      numa_replicas ? 0 : ARENA_INTERLEAVE);
+}
+
+// Copy a window that was just read to its copies on the other nodes
+void Dataset::replicate_window(const char* window, std::vector<char*>& copies, bool parallel) {
+    if (!numa_replicas) return;
+    size_t bytes = (size_t) num_local_items*data_item_size*data_type_size;
+    size_t block = HUGE_PAGE_SIZE;
+    long num_blocks = (bytes + block - 1) / block;
+    for (int node = 1; node < copies.size(); node++) {
+        if (copies[node] == NULL) copies[node] = buffer_arena.acquire<char>(bytes, node);
+        char* replica = copies[node];
+#pragma omp parallel for if (parallel)
+        for (long i = 0; i < num_blocks; i++) {
+            memcpy(replica + i * block, window + i * block, std::min(block, bytes - i * block));
+        }
+    }
+}
+
+// The replica of the window on the calling thread's node
+inline const char* Dataset::local_window() {
+    if (!numa_replicas) return data_buffer;
+    int node = current_numa_node();
+    return node > 0 && node < replicas.size() ? replicas[node] : data_buffer;
+}
+
+void Dataset::resume() {
+    double start_time = omp_get_wtime();
+    data_buffer = acquire_window();
+    label_buffer = buffer_arena.acquire<float>((size_t) num_local_items*label_item_size);
+    std::unique_lock<std::mutex> lock(hdf5_mutex);
+    debug("Resuming with %d slabs starting with slab %d", slabs_per_window, window_starts[0]);
+    read_items(window_pieces(&window_starts[0]), data_buffer, label_buffer, lock);
+    replicate_window(data_buffer, replicas, true);
+    stats.add_time(IO_STALL, omp_get_wtime() - start_time);
+    suspended = false;
+    if (prefetch) {
+        next_data_buffer = acquire_window();
+        next_label_buffer = buffer_arena.acquire<float>((size_t) num_local_items*label_item_size);
+        start_prefetch();
+    }
+}
+
 void Dataset::get_next_batch() {
+    if (suspended) resume();
+    stats.add(IO_BATCHES, 1);
+    if (streaming) {
+        int slot = acquire_stream_batch();
+        double start_time = omp_get_wtime();
+        if (transform.enabled) draw_transforms();
+#pragma omp parallel for
+        for (int i = 0; i < batch_size; i++) {
+            copy_item(i, batch_idxs[i], data_buffer);
+        }
+        stats.add_time(IO_GATHER, omp_get_wtime() - start_time);
+        release_stream_batch(slot);
+        return;
+    }
+    // Time spent in fetch_next_chunk is accounted for as stalls
+    double start_time = omp_get_wtime();
+    if (transform.enabled) draw_transforms();
     int start = curr_item;
     int end = std::min(curr_item + batch_size, num_local_items);
-#pragma omp parallel for
-    for (int i = start; i < end; i++) {
-        int n = batch_idxs[i];
-        memcpy(data_out + (i-start)*data_item_size, data_buffer + n*data_item_size,
-               data_item_size*sizeof(float));
-        memcpy(label_out + (i-start)*label_item_size, label_buffer + n*label_item_size,
-               label_item_size*sizeof(float));
+#pragma omp parallel
+    {
+        const char* data = local_window();
+#pragma omp for
+        for (int i = start; i < end; i++) {
+            copy_item(i - start, batch_idxs[i], data);
+        }
     }
+    double gather_time = omp_get_wtime() - start_time;
     if (end != curr_item + batch_size) {
         fetch_next_chunk(false);
+        start_time = omp_get_wtime();
         int leftover_start = 0;
         int leftover_end = curr_item+batch_size-end;
         curr_item = 0;
-#pragma omp parallel for
-        for (int i = leftover_start; i < leftover_end; i++) {
-            memcpy(data_out + (i + end - start)*data_item_size, data_buffer + batch_idxs[i]*data_item_size,
-                   data_item_size*sizeof(float));
-            memcpy(label_out + (i + end - start)*label_item_size, label_buffer + batch_idxs[i]*label_item_size,
-                   label_item_size*sizeof(float));
+#pragma omp parallel
+        {
+            const char* data = local_window();
+#pragma omp for
+            for (int i = leftover_start; i < leftover_end; i++) {
+                copy_item(i + end - start, batch_idxs[i], data);
+            }
         }
         curr_item += leftover_end;
+        gather_time += omp_get_wtime() - start_time;
     } else if (curr_item == num_local_items) {
         curr_item = 0;
         fetch_next_chunk(false);
     } else {
         curr_item = end;
     }
+    stats.add_time(IO_GATHER, gather_time);
 }
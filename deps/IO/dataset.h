@@ -33,10 +33,23 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <assert.h>
 #include <string.h>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
 #ifdef LATTE_BUILD_MPI
 #include <mpi.h>
 #endif
 #include <omp.h>
+#include "sample_types.h"
+#include "raw_format.h"
+#include "arena.h"
+#include "io_stats.h"
 
 #ifdef DEBUG
 #define debug(M, ...) fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__)
@@ -44,11 +57,148 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define debug(M, ...)
 #endif
 
+// The HDF5 library is not guaranteed to be thread safe, every call that can
+// overlap with a prefetch thread must hold this lock.
+extern std::mutex hdf5_mutex;
+
+// Default size in bytes of the resident window of a dataset
+#define DEFAULT_MEMORY_BUDGET 2000000000ul
+// Default number of shard files a dataset keeps open at once
+#define DEFAULT_MAX_OPEN_FILES 64
+// Default number of batches a streaming dataset reads ahead
+#define DEFAULT_READ_AHEAD 2
+// Format of Dataset::save_state
+#define DATASET_STATE_VERSION 1
+
+// Passed by pointer from Julia, see DatasetOptions in hdf5-data.jl, which
+// must keep the same fields in the same order
+struct DatasetOptions {
+    // Upper bound in bytes of the resident data and label window
+    size_t memory_budget;
+    // Number of randomly chosen slabs that make up the resident window when
+    // the dataset does not fit in memory_budget
+    int window_slabs;
+    // In MPI mode, read windows with collective MPI-IO and reassign slabs
+    // of the whole file to ranks every epoch
+    bool collective_io;
+    // Upper bound on the shard files of a manifest that are open at once
+    int max_open_files;
+    // Read every batch item by item in a global permutation of the dataset
+    // instead of gathering from a resident window, with read_ahead batches
+    // read in the background
+    bool streaming;
+    int read_ahead;
+    // Take the window from buffer_arena only while the dataset is in use,
+    // so that datasets used in turn (train and test) share one window's
+    // worth of memory.  See Dataset::suspend.
+    bool share_buffers;
+    // On multi-socket nodes, keep a copy of the window on every NUMA node
+    // so that gather threads read local memory.  Otherwise the window is
+    // interleaved over the nodes.
+    bool numa_replicas;
+    // Seed of the shuffles and random transforms of the dataset
+    unsigned int seed;
+
+    DatasetOptions() : memory_budget(DEFAULT_MEMORY_BUDGET), window_slabs(1),
+                       collective_io(false), max_open_files(DEFAULT_MAX_OPEN_FILES),
+                       streaming(false), read_ahead(DEFAULT_READ_AHEAD), share_buffers(false),
+                       numa_replicas(false), seed(0) {}
+};
+
+// Preprocessing fused into the gather of get_next_batch.  Applies to 4
+// dimensional (N, C, H, W) data: each item is mean subtracted, scaled,
+// cropped to crop_height x crop_width and optionally mirrored horizontally.
+// A scale alone leaves the transform disabled and applies to data of any
+// rank while the samples are widened.
+struct Transform {
+    bool enabled;
+    float* mean;       // stored item sized mean, NULL to skip subtraction
+    float scale;
+    int crop_height;
+    int crop_width;
+    bool random_crop;  // random crop offsets, otherwise centered
+    bool mirror;       // mirror each item with probability 0.5
+
+    Transform() : enabled(false), mean(NULL), scale(1.0f), crop_height(0),
+                  crop_width(0), random_crop(false), mirror(false) {}
+};
+
+// One HDF5 file of a dataset, holding items [first, first + num_items) of
+// the logical dataset.  A dataset is a single shard unless it is opened
+// from a manifest, whose shards are opened on first use.
+struct Shard {
+    std::string file_name;
+    int first;
+    int num_items;
+    hid_t file_id;  // -1 while the shard is closed
+    hid_t data_dataset_id;
+    hid_t label_dataset_id;
+    unsigned long last_use;
+    // Chunked /data: rows per storage chunk (0 when contiguous) and position
+    // of the shuffle and deflate filters in its pipeline (-1 when absent).
+    // With direct_chunks the chunks are read with H5Dread_chunk and inflated
+    // by all threads instead of going through the HDF5 filter pipeline.
+    int storage_chunk_items;
+    size_t storage_chunk_bytes;
+    int shuffle_filter;
+    int deflate_filter;
+    bool direct_chunks;
+
+    Shard() : first(0), num_items(-1), file_id(-1), data_dataset_id(-1), label_dataset_id(-1),
+              last_use(0), storage_chunk_items(0), storage_chunk_bytes(0), shuffle_filter(-1),
+              deflate_filter(-1), direct_chunks(false) {}
+};
+
+// Items [start, start + count) of a shard that land at item dst of the
+// window
+struct WindowPiece {
+    int shard;
+    int start;
+    int count;
+    int dst;
+};
+
+// A storage chunk of a chunked /data read with H5Dread_chunk, rows [first,
+// last) of the chunk land at item dst of the window
+struct StoredChunk {
+    int shard;
+    int row;
+    int first;
+    int last;
+    int dst;
+    size_t offset;         // into compressed_buffer
+    size_t size;
+    uint32_t filter_mask;  // filters skipped when the chunk was written
+};
+
+// A batch read by the stream thread: its items in item order, the position
+// in data/label of every item of the batch, and the epoch and position in
+// the epoch's permutation it ends at
+struct StreamBatch {
+    char* data;
+    float* label;
+    int* idxs;
+    int epoch;
+    int end_pos;
+};
+
 class Dataset {
     int* chunks;
     int* batch_idxs;
-    float* data_buffer;
+    // data_buffer holds samples in their stored data_type, they are widened
+    // to float by get_next_batch
+    char* data_buffer;
     float* label_buffer;
+    int data_type;
+    size_t data_type_size;
+    float data_scale;
+    // Back buffers filled by the prefetch thread with chunks[chunk_idx] while
+    // data_buffer/label_buffer are being consumed
+    char* next_data_buffer;
+    float* next_label_buffer;
+    std::thread prefetch_thread;
+    bool prefetch;
+    bool prefetch_pending;
 
     bool shuffle;
     int curr_item;
@@ -57,31 +207,137 @@ class Dataset {
     int label_item_size;
     int num_local_items;
     int num_total_items;
-    hid_t data_dataset_id;
-    hid_t label_dataset_id;
-    hid_t file_id;
+    std::vector<Shard> shards;
+    int max_open_files;
+    int open_files;
+    unsigned long shard_clock;
     int chunk_start;
     int chunk_idx;
     int chunk_end;
+    // chunks holds the start of every slab, the resident window is made of
+    // slabs_per_window consecutive entries beginning at chunk_offset +
+    // chunk_idx.  This rank reads n_chunks of the n_total_chunks slabs.
     int n_chunks;
+    int n_total_chunks;
+    int chunk_offset;
+    int slab_size;
+    int slabs_per_window;
+    // Collective mode: num_parts ranks share the slabs of the whole file
+    // and shuffle them identically with slab_rng
+    bool collective;
+    int num_parts;
+    std::mt19937 slab_rng;
+    // Draws the permutations of slabs and items and the random transforms
+    std::mt19937 rng;
     bool use_mpi;
+    // Base and length of the mapping when reading a raw format file, NULL
+    // for HDF5 files
+    char* map_base;
+    size_t map_length;
+    // Streaming mode: stream_thread reads the batches of stream_order, a
+    // permutation of this rank's items, into the free slots of
+    // stream_batches.  get_next_batch gathers from the oldest ready slot.
+    bool streaming;
+    std::vector<int> stream_order;
+    int stream_pos;
+    int stream_epoch;
+    unsigned int stream_seed;
+    // Where the batch after the one last gathered starts
+    int next_stream_pos;
+    int next_stream_epoch;
+    std::vector<StreamBatch> stream_batches;
+    std::deque<int> stream_free;
+    std::deque<int> stream_ready;
+    std::mutex stream_mutex;
+    std::condition_variable stream_cond;
+    std::thread stream_thread;
+    bool stream_stopping;
+    // Storage chunks of the window being read when they are inflated here
+    std::vector<StoredChunk> stored_chunks;
+    std::vector<char> compressed_buffer;
+    // Slab starts of the resident window, reread when a suspended dataset
+    // is resumed
+    std::vector<int> window_starts;
+    bool suspended;
+    // Copies of data_buffer bound to each NUMA node but node 0, refreshed
+    // whenever a new window is read.  next_replicas are the copies of
+    // next_data_buffer, made by the prefetch thread.
+    bool numa_replicas;
+    std::vector<char*> replicas;
+    std::vector<char*> next_replicas;
+    Transform transform;
+    int out_item_size;
+    // Crop offsets and mirror flags of every item of the current batch
+    int* crop_y;
+    int* crop_x;
+    bool* flip;
+    void draw_transforms();
+    void transform_item(int dst, int src, const char* data);
+    void open_hdf5(char* data_file_name);
+    void open_raw(char* data_file_name);
+    void read_manifest(char* manifest_file_name);
+    Shard& open_shard(int s);
+    void close_shard(Shard& shard);
+    int read_item_info(Shard& shard);
+    int check_item_info(Shard& shard);
+    void open_chunked(Shard& shard);
+    int find_shard(int row);
+    std::vector<WindowPiece> window_pieces(const int* window);
+    void read_pieces(hid_t dataset, hid_t mem_type, int ndim, int* shape,
+                     const std::vector<WindowPiece>& pieces, int begin, int end,
+                     hid_t xfer_plist, void* dst);
+    void read_window(int first_slab, char* data_dst, float* label_dst);
+    void read_items(const std::vector<WindowPiece>& pieces, char* data_dst, float* label_dst,
+                    std::unique_lock<std::mutex>& lock);
+    void read_stored_chunks(const std::vector<WindowPiece>& pieces, int begin, int end);
+    void inflate_chunks(char* data_dst);
+    void copy_item(int dst, int src, const char* data);
+    void shuffle_chunks();
+    void advance_chunk();
+    void start_prefetch();
+    void prefetch_window(int first_slab);
+    void finish_prefetch();
+    void start_stream(int read_ahead);
+    void run_stream();
+    void draw_stream_order();
+    void read_stream_batch(StreamBatch& batch);
+    int acquire_stream_batch();
+    void release_stream_batch(int slot);
+    void resume();
+    char* acquire_window();
+    void replicate_window(const char* window, std::vector<char*>& copies, bool parallel);
+    const char* local_window();
     public:
         int epoch;
         int  data_ndim;
         int* data_shape;
+        // Shape of the items produced by get_next_batch, differs from
+        // data_shape when cropping
+        int* out_shape;
         int  label_ndim;
         int* label_shape;
         float* data_out;
         float* label_out;
+        bool share_buffers;
+        IOStats stats;
         void fetch_next_chunk(bool force);
         void get_next_batch();
+        void set_prefetch(bool enable);
+        // Whether reads may run on a background thread, warns that feature
+        // is disabled if not
+        bool background_reads_allowed(const char* feature);
+        void stop_stream();
+        void suspend();
+        std::string save_state();
+        void restore_state(const std::string& saved);
+        void set_transform(char* mean_file_name, float scale, int crop_height, int crop_width,
+                           bool random_crop, bool mirror);
 
-        Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use_mpi, bool divide_by_rank);
-	~Dataset() {
-	    H5Dclose(data_dataset_id);
-	    H5Dclose(label_dataset_id);
-	    H5Fclose(file_id);
-	};
+        // Datasets are split over size ranks unless size is 1, or over the
+        // inter-net communicator if use_mpi is set
+        Dataset(char* data_file_name, int _batch_size, bool _shuffle, bool _use_mpi, int rank, int size,
+                bool divide_by_rank, const DatasetOptions& options);
+        ~Dataset();
 };
 
 #endif /* LATTE_IO_DATASET_H */
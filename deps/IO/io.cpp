@@ -27,35 +27,148 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "io.h"
 
-void init(bool use_mpi) {
+// rank and size are those of the comm library's transport, 0 and 1 when it
+// is not used.  Datasets are split over the ranks, through MPI-IO if use_mpi
+// is set.
+void init(bool use_mpi, int rank, int size) {
+#ifndef LATTE_BUILD_MPI
     if (use_mpi) {
-#ifdef LATTE_BUILD_MPI
-        // MPI_Init(NULL, NULL);
-        MPI_Comm comm  = MPI_COMM_WORLD;
-        // MPI_Info info  = MPI_INFO_NULL;
-
-        // MPI_Comm_size(comm, &mpi_size);
-        MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);  
-        srand(time(NULL) + mpi_rank);
-#else
         std::cerr << "Error: To use Latte in MPI mode, please rebuild IO library with -DLATTE_MPI=ON" << std::endl;
         assert(false);
-#endif
-        // MPI_Barrier(comm);
-    } else {
-        srand(time(NULL));
     }
+#endif
+    assert(rank >= 0 && rank < size);
+    comm_rank = rank;
+    comm_size = size;
+    srand(time(NULL) + comm_rank);
+}
+
+// Seed of dataset id of this rank, derived from base_seed so that datasets
+// and ranks draw different permutations
+static unsigned int dataset_seed(int id, unsigned int kind, unsigned int base_seed) {
+    unsigned int seed = base_seed != 0 ? base_seed : rand();
+    std::seed_seq seq{seed, kind, (unsigned int) id, (unsigned int) comm_rank};
+    seq.generate(&seed, &seed + 1);
+    return seed;
 }
 
 int init_dataset(int _batch_size, char *data_file_name, bool _shuffle, bool use_mpi, bool divide_by_rank)
 {
-    Dataset* dset = new Dataset(data_file_name, _batch_size, _shuffle, use_mpi, divide_by_rank);
+    return init_dataset_with_options(_batch_size, data_file_name, _shuffle, use_mpi,
+                                     divide_by_rank, &dataset_options);
+}
 
+// init_dataset with its own options instead of those of the setters below
+int init_dataset_with_options(int _batch_size, char *data_file_name, bool _shuffle, bool use_mpi,
+                              bool divide_by_rank, const DatasetOptions* dataset_options)
+{
     int id = datasets.size();
+    DatasetOptions options = *dataset_options;
+    options.seed = dataset_seed(id, 0, options.seed);
+    Dataset* dset = new Dataset(data_file_name, _batch_size, _shuffle, use_mpi, comm_rank, comm_size,
+                                divide_by_rank,
+                                options);
+
     datasets.push_back(dset);
+    loaders.push_back(NULL);
     return id;
 }
 
+void set_memory_budget(size_t bytes) {
+    assert(bytes > 0);
+    dataset_options.memory_budget = bytes;
+}
+
+void set_window_slabs(int num_slabs) {
+    assert(num_slabs > 0);
+    dataset_options.window_slabs = num_slabs;
+}
+
+void set_collective_io(bool enable) {
+    dataset_options.collective_io = enable;
+}
+
+// Stream later datasets batch by batch in a global permutation instead of
+// reading them into a resident window
+void set_streaming(bool enable) {
+    dataset_options.streaming = enable;
+}
+
+// Number of batches a streaming dataset reads ahead of get_next_batch
+void set_read_ahead(int num_batches) {
+    assert(num_batches > 0);
+    dataset_options.read_ahead = num_batches;
+}
+
+// Bound the number of shard files of a manifest a dataset keeps open
+void set_max_open_files(int num_files) {
+    assert(num_files > 0);
+    dataset_options.max_open_files = num_files;
+}
+
+// Let later datasets give their window back to the buffer arena while
+// another dataset opened this way is read, e.g. the training set while the
+// test set is evaluated
+void set_share_buffers(bool enable) {
+    dataset_options.share_buffers = enable;
+}
+
+// Replicate the window of later datasets on every NUMA node instead of
+// interleaving it over the nodes
+void set_numa_replicas(bool enable) {
+    dataset_options.numa_replicas = enable;
+}
+
+// Seed the shuffles of later datasets, 0 seeds them from the clock
+void set_seed(unsigned int seed) {
+    dataset_options.seed = seed;
+}
+
+// Copy the state of a dataset (see Dataset::save_state) into buffer if it
+// holds size bytes, returns the size of the state.  Datasets read by a
+// loader are ahead of the consumer and cannot be saved.
+int save_state(int dset_id, char* buffer, int size) {
+    assert(dset_id < datasets.size() && loaders[dset_id] == NULL);
+    std::string state = datasets[dset_id]->save_state();
+    if (buffer != NULL && size >= state.size()) {
+        memcpy(buffer, state.data(), state.size());
+    }
+    return state.size();
+}
+
+// Resume a dataset at the batch after the one gathered when state was
+// saved.  Collective datasets must be restored on all ranks at once.
+void restore_state(int dset_id, char* buffer, int size) {
+    assert(dset_id < datasets.size() && loaders[dset_id] == NULL);
+    datasets[dset_id]->restore_state(std::string(buffer, size));
+}
+
+size_t get_arena_bytes() {
+    return buffer_arena.resident_bytes();
+}
+
+// IO counters of a dataset, counter is an IOCounter (see io_stats.h)
+double get_io_counter(int dset_id, int counter) {
+    assert(dset_id < datasets.size());
+    return datasets[dset_id]->stats.get(counter);
+}
+
+int get_io_histogram_buckets() {
+    return IO_HISTOGRAM_BUCKETS;
+}
+
+// Copy the latency histogram of timer, an IOTimer, into counts which holds
+// get_io_histogram_buckets() entries
+void get_io_histogram(int dset_id, int timer, unsigned long* counts) {
+    assert(dset_id < datasets.size());
+    datasets[dset_id]->stats.get_histogram(timer, counts);
+}
+
+void reset_io_stats(int dset_id) {
+    assert(dset_id < datasets.size());
+    datasets[dset_id]->stats.reset();
+}
+
 int get_data_ndim(int dset_id) {
     assert(dset_id < datasets.size());
     return datasets[dset_id]->data_ndim;
@@ -63,7 +176,7 @@ int get_data_ndim(int dset_id) {
 
 int* get_data_shape(int dset_id) {
     assert(dset_id < datasets.size());
-    return datasets[dset_id]->data_shape;
+    return datasets[dset_id]->out_shape;
 }
 
 int get_label_ndim(int dset_id) {
@@ -86,21 +199,157 @@ void set_label_pointer(int dset_id, float* pointer) {
     datasets[dset_id]->label_out = pointer;
 }
 
+void set_prefetch(int dset_id, bool enable) {
+    assert(dset_id < datasets.size());
+    datasets[dset_id]->set_prefetch(enable);
+}
+
+void set_transform(int dset_id, char* mean_file_name, float scale, int crop_height, int crop_width,
+                   bool random_crop, bool mirror) {
+    assert(dset_id < datasets.size());
+    datasets[dset_id]->set_transform(mean_file_name, scale, crop_height, crop_width,
+                                     random_crop, mirror);
+}
+
+// Register a ring of num_buffers output buffers that a background loader
+// fills with consecutive batches, replaces set_data_pointer and
+// set_label_pointer.  num_threads sets the size of the loader's OpenMP team,
+// 0 keeps the default.
+void set_output_buffers(int dset_id, int num_buffers, float** data_pointers,
+                        float** label_pointers, int num_threads) {
+    assert(dset_id < datasets.size());
+    stop_loader(dset_id);
+    loaders[dset_id] = new BatchLoader(datasets[dset_id], num_buffers, data_pointers,
+                                       label_pointers, num_threads);
+}
+
+// Block until the oldest filled buffer is ready and return its index, the
+// buffer is owned by the caller until it is handed back with fill_batch
+int acquire_batch(int dset_id) {
+    assert(dset_id < datasets.size() && loaders[dset_id] != NULL);
+    return loaders[dset_id]->acquire();
+}
+
+// Hand buffer back to the loader to be filled asynchronously with the next
+// batch
+void fill_batch(int dset_id, int buffer) {
+    assert(dset_id < datasets.size() && loaders[dset_id] != NULL);
+    loaders[dset_id]->fill(buffer);
+}
+
+void stop_loader(int dset_id) {
+    assert(dset_id < datasets.size());
+    delete loaders[dset_id];
+    loaders[dset_id] = NULL;
+}
+
+// Sequence datasets (see sequence_dataset.h) have their own ids.  Batches are
+// (max_steps, batch_size, item) and padded with zeros, batch_steps is the
+// number of steps of the longest sequence of the current batch.
+int init_sequence_dataset(int _batch_size, int max_steps, char *data_file_name, bool _shuffle,
+                          bool use_mpi, int bucket_pool) {
+    int id = sequence_datasets.size();
+    SequenceDataset* dset = new SequenceDataset(data_file_name, _batch_size, max_steps, _shuffle,
+                                                use_mpi, comm_rank, comm_size, bucket_pool,
+                                                dataset_seed(id, 1, dataset_options.seed));
+    sequence_datasets.push_back(dset);
+    return id;
+}
+
+void get_next_sequence_batch(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    sequence_datasets[dset_id]->get_next_batch();
+}
+
+int get_sequence_epoch(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->epoch + 1;  // 1-based indexing
+}
+
+int get_sequence_batch_steps(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->batch_steps;
+}
+
+int* get_sequence_lengths(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->lengths;
+}
+
+int* get_sequence_data_shape(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->data_shape;
+}
+
+int get_sequence_data_ndim(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->data_ndim;
+}
+
+int* get_sequence_label_shape(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->label_shape;
+}
+
+int get_sequence_label_ndim(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->label_ndim;
+}
+
+bool get_sequence_label_per_step(int dset_id) {
+    assert(dset_id < sequence_datasets.size());
+    return sequence_datasets[dset_id]->label_per_step;
+}
+
+void set_sequence_data_pointer(int dset_id, float* pointer) {
+    assert(dset_id < sequence_datasets.size());
+    sequence_datasets[dset_id]->data_out = pointer;
+}
+
+void set_sequence_label_pointer(int dset_id, float* pointer) {
+    assert(dset_id < sequence_datasets.size());
+    sequence_datasets[dset_id]->label_out = pointer;
+}
+
 void next_epoch(int dset_id)
 {
 }
 
 void get_next_batch(int dset_id) {
     assert(dset_id < datasets.size());
+    // batches come from acquire_batch while a loader is running
+    assert(loaders[dset_id] == NULL);
+    if (datasets[dset_id]->share_buffers) {
+        // Datasets sharing buffers take turns being resident, those read by
+        // a loader are never suspended
+        for (int i = 0; i < datasets.size(); i++) {
+            if (i != dset_id && loaders[i] == NULL) datasets[i]->suspend();
+        }
+    }
     datasets[dset_id]->get_next_batch();
 }
 
 int get_epoch(int dset_id) {
     assert(dset_id < datasets.size());
+    if (loaders[dset_id] != NULL) {
+        return loaders[dset_id]->epoch + 1;  // 1-based indexing
+    }
     return datasets[dset_id]->epoch + 1;  // 1-based indexing
 }
 
 
 void clean_up() {
+  // Background reads must not outlive the process' HDF5 library
+  for (int i = 0; i < datasets.size(); i++) {
+      stop_loader(i);
+      datasets[i]->set_prefetch(false);
+      delete datasets[i];
+  }
   datasets.clear();
+  loaders.clear();
+  for (int i = 0; i < sequence_datasets.size(); i++) {
+      delete sequence_datasets[i];
+  }
+  sequence_datasets.clear();
+  buffer_arena.trim();
 }
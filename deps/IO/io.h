@@ -37,9 +37,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <algorithm>
 
 #include "dataset.h"
+#include "loader.h"
+#include "sequence_dataset.h"
 
-int mpi_size;
-int mpi_rank;
+// Rank and number of ranks of the comm library's transport, set by init
+int comm_rank;
+int comm_size = 1;
 #ifdef LATTE_BUILD_MPI
 MPI_Comm comm  = MPI_COMM_WORLD;
 MPI_Info info  = MPI_INFO_NULL;
@@ -47,13 +50,20 @@ MPI_Info info  = MPI_INFO_NULL;
 
 
 std::vector<Dataset*> datasets;
+// Background loader of each dataset, NULL unless output buffers were registered
+std::vector<BatchLoader*> loaders;
+// Options applied to every dataset created by subsequent init_dataset calls
+DatasetOptions dataset_options;
+std::vector<SequenceDataset*> sequence_datasets;
 
 // initialize parallel IO library
 extern "C" {
-    void init(bool use_mpi);
+    void init(bool use_mpi, int rank, int size);
     void clean_up();
 
     int init_dataset(int _batch_size, char *data_file_name, bool _shuffle, bool use_mpi, bool divide_by_rank);
+    int init_dataset_with_options(int _batch_size, char *data_file_name, bool _shuffle, bool use_mpi,
+                                  bool divide_by_rank, const DatasetOptions* options);
     void get_next_batch(int dset_id);
     int get_epoch(int dset_id);
     int* get_data_shape(int dset_id);
@@ -62,4 +72,42 @@ extern "C" {
     int  get_label_ndim(int dset_id);
     void set_data_pointer(int dset_id, float* pointer);
     void set_label_pointer(int dset_id, float* pointer);
+    void set_prefetch(int dset_id, bool enable);
+    void set_memory_budget(size_t bytes);
+    void set_window_slabs(int num_slabs);
+    void set_collective_io(bool enable);
+    void set_max_open_files(int num_files);
+    void set_streaming(bool enable);
+    void set_read_ahead(int num_batches);
+    void set_share_buffers(bool enable);
+    void set_numa_replicas(bool enable);
+    void set_seed(unsigned int seed);
+    int  save_state(int dset_id, char* buffer, int size);
+    void restore_state(int dset_id, char* buffer, int size);
+    size_t get_arena_bytes();
+    double get_io_counter(int dset_id, int counter);
+    int  get_io_histogram_buckets();
+    void get_io_histogram(int dset_id, int timer, unsigned long* counts);
+    void reset_io_stats(int dset_id);
+    void set_transform(int dset_id, char* mean_file_name, float scale, int crop_height, int crop_width,
+                       bool random_crop, bool mirror);
+    void set_output_buffers(int dset_id, int num_buffers, float** data_pointers,
+                            float** label_pointers, int num_threads);
+    int  acquire_batch(int dset_id);
+    void fill_batch(int dset_id, int buffer);
+    void stop_loader(int dset_id);
+
+    int init_sequence_dataset(int _batch_size, int max_steps, char *data_file_name, bool _shuffle,
+                              bool use_mpi, int bucket_pool);
+    void get_next_sequence_batch(int dset_id);
+    int get_sequence_epoch(int dset_id);
+    int get_sequence_batch_steps(int dset_id);
+    int* get_sequence_lengths(int dset_id);
+    int* get_sequence_data_shape(int dset_id);
+    int  get_sequence_data_ndim(int dset_id);
+    int* get_sequence_label_shape(int dset_id);
+    int  get_sequence_label_ndim(int dset_id);
+    bool get_sequence_label_per_step(int dset_id);
+    void set_sequence_data_pointer(int dset_id, float* pointer);
+    void set_sequence_label_pointer(int dset_id, float* pointer);
 }
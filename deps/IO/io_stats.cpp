@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <string.h>
+#include "io_stats.h"
+
+void IOStats::add(IOCounter counter, double value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[counter] += value;
+}
+
+void IOStats::add_time(IOTimer timer, double seconds) {
+    int bucket = 0;
+    for (double us = seconds * 1e6; us >= 1.0 && bucket < IO_HISTOGRAM_BUCKETS - 1; us /= 2) {
+        bucket++;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[IO_READ_TIME + timer] += seconds;
+    histograms[timer][bucket]++;
+}
+
+double IOStats::get(int counter) {
+    assert(counter >= 0 && counter < IO_NUM_COUNTERS);
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters[counter];
+}
+
+void IOStats::get_histogram(int timer, unsigned long* counts) {
+    assert(timer >= 0 && timer < IO_NUM_TIMERS);
+    std::lock_guard<std::mutex> lock(mutex);
+    memcpy(counts, histograms[timer], sizeof(histograms[timer]));
+}
+
+void IOStats::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    memset(counters, 0, sizeof(counters));
+    memset(histograms, 0, sizeof(histograms));
+}
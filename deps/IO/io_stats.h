@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_IO_STATS_H
+#define LATTE_IO_STATS_H
+#include <stddef.h>
+#include <mutex>
+
+// Counters kept by every dataset, times are in seconds
+enum IOCounter {
+    IO_BYTES_READ,     // bytes of samples and labels read into windows or
+                       // streamed batches
+    IO_ITEMS_READ,
+    IO_READS,          // windows or streamed batches read
+    IO_BATCHES,        // batches gathered by get_next_batch
+    IO_READ_TIME,      // reading, on whichever thread does it
+    IO_GATHER_TIME,    // copying batches out in get_next_batch
+    IO_STALL_TIME,     // get_next_batch waiting for a window or batch
+    IO_SHUFFLE_TIME,   // drawing permutations of items and slabs
+    IO_NUM_COUNTERS
+};
+
+// Timed events, each has a total (IO_READ_TIME + timer) and a histogram
+enum IOTimer {
+    IO_READ,
+    IO_GATHER,
+    IO_STALL,
+    IO_SHUFFLE,
+    IO_NUM_TIMERS
+};
+
+// Bucket 0 counts events shorter than 1us, bucket i > 0 those in
+// [2^(i-1), 2^i) us and the last bucket everything longer
+#define IO_HISTOGRAM_BUCKETS 32
+
+// Always on counters and latency histograms of a dataset, updated from the
+// prefetch, stream and loader threads as well as the caller's
+class IOStats {
+    std::mutex mutex;
+    double counters[IO_NUM_COUNTERS];
+    unsigned long histograms[IO_NUM_TIMERS][IO_HISTOGRAM_BUCKETS];
+    public:
+        void add(IOCounter counter, double value);
+        void add_time(IOTimer timer, double seconds);
+        double get(int counter);
+        void get_histogram(int timer, unsigned long* counts);
+        void reset();
+
+        IOStats() { reset(); }
+};
+
+#endif /* LATTE_IO_STATS_H */
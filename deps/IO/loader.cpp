@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "loader.h"
+
+BatchLoader::BatchLoader(Dataset* _dataset, int num_buffers, float** data_pointers,
+                         float** label_pointers, int _num_threads) {
+    assert(num_buffers > 0);
+    dataset = _dataset;
+    num_threads = _num_threads;
+    stopping = false;
+    epoch = dataset->epoch;
+    for (int i = 0; i < num_buffers; i++) {
+        data_buffers.push_back(data_pointers[i]);
+        label_buffers.push_back(label_pointers[i]);
+        buffer_epochs.push_back(epoch);
+        fill_queue.push_back(i);
+    }
+    synchronous = !dataset->background_reads_allowed("the batch loader");
+    if (!synchronous) thread = std::thread(&BatchLoader::run, this);
+}
+
+BatchLoader::~BatchLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    if (!synchronous) thread.join();
+}
+
+void BatchLoader::run() {
+    // The gather is an OpenMP loop, its team size is set for this thread only
+    if (num_threads > 0) omp_set_num_threads(num_threads);
+    while (true) {
+        int buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (fill_queue.empty() && !stopping) cond.wait(lock);
+            if (stopping) return;
+            buffer = fill_queue.front();
+            fill_queue.pop_front();
+        }
+        fill_buffer(buffer);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready_queue.push_back(buffer);
+        }
+        cond.notify_all();
+    }
+}
+
+void BatchLoader::fill_buffer(int buffer) {
+    // The dataset is only touched by this thread while the loader runs
+    dataset->data_out = data_buffers[buffer];
+    dataset->label_out = label_buffers[buffer];
+    dataset->get_next_batch();
+    buffer_epochs[buffer] = dataset->epoch;
+}
+
+int BatchLoader::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (synchronous) {
+        assert(!fill_queue.empty());
+        int buffer = fill_queue.front();
+        fill_queue.pop_front();
+        fill_buffer(buffer);
+        epoch = buffer_epochs[buffer];
+        return buffer;
+    }
+    while (ready_queue.empty()) cond.wait(lock);
+    int buffer = ready_queue.front();
+    ready_queue.pop_front();
+    epoch = buffer_epochs[buffer];
+    return buffer;
+}
+
+void BatchLoader::fill(int buffer) {
+    assert(buffer >= 0 && buffer < (int) data_buffers.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fill_queue.push_back(buffer);
+    }
+    cond.notify_all();
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_IO_LOADER_H
+#define LATTE_IO_LOADER_H
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "dataset.h"
+
+// Fills a ring of output buffers from a Dataset on a background thread so
+// that gathering batch k+1 overlaps the computation on batch k.
+//
+// Every buffer is either queued for filling, being filled, ready, or held
+// by the consumer.  acquire() hands out ready buffers in the order they were
+// filled and fill() returns a held buffer to the loader to be refilled.
+class BatchLoader {
+    Dataset* dataset;
+    std::vector<float*> data_buffers;
+    std::vector<float*> label_buffers;
+    // epoch of the dataset when each buffer was filled
+    std::vector<int> buffer_epochs;
+    std::deque<int> fill_queue;
+    std::deque<int> ready_queue;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    int num_threads;
+    bool stopping;
+    // Buffers are filled by acquire() on the calling thread, without a loader
+    // thread, when the dataset cannot be read in the background
+    bool synchronous;
+    void run();
+    void fill_buffer(int buffer);
+    public:
+        // epoch of the most recently acquired batch
+        int epoch;
+        int acquire();
+        void fill(int buffer);
+
+        BatchLoader(Dataset* _dataset, int num_buffers, float** data_pointers,
+                    float** label_pointers, int _num_threads);
+        ~BatchLoader();
+};
+
+#endif /* LATTE_IO_LOADER_H */
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_IO_RAW_FORMAT_H
+#define LATTE_IO_RAW_FORMAT_H
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "sample_types.h"
+
+// Latte raw tensor format
+//
+// A fixed size header followed by the data payload and the label payload.
+// Both payloads are stored item-major in C order and start on a page boundary
+// so that they can be mapped and read in place:
+//
+//     [RawHeader][pad][data: shape[0] x item][pad][label: shape[0] x item]
+#define LATTE_RAW_MAGIC "LATTERAW"
+#define LATTE_RAW_VERSION 1
+#define LATTE_RAW_MAX_NDIM 8
+#define LATTE_RAW_ALIGNMENT 4096
+
+struct RawHeader {
+    char     magic[8];
+    int32_t  version;
+    int32_t  data_type;  // SampleType of the data payload, labels are float
+    int32_t  data_ndim;
+    int32_t  label_ndim;
+    int64_t  data_shape[LATTE_RAW_MAX_NDIM];
+    int64_t  label_shape[LATTE_RAW_MAX_NDIM];
+    uint64_t data_offset;
+    uint64_t label_offset;
+    uint64_t file_size;
+    float    data_scale;  // factor applied to samples when widened to float
+};
+
+inline uint64_t raw_align(uint64_t offset) {
+    return (offset + LATTE_RAW_ALIGNMENT - 1) / LATTE_RAW_ALIGNMENT * LATTE_RAW_ALIGNMENT;
+}
+
+// Fill in the offsets and total size of header from its shapes
+inline void raw_header_layout(RawHeader* header) {
+    uint64_t data_bytes = sample_type_size(header->data_type);
+    for (int i = 0; i < header->data_ndim; i++) data_bytes *= header->data_shape[i];
+    uint64_t label_bytes = sizeof(float);
+    for (int i = 0; i < header->label_ndim; i++) label_bytes *= header->label_shape[i];
+    header->data_offset = raw_align(sizeof(RawHeader));
+    header->label_offset = raw_align(header->data_offset + data_bytes);
+    header->file_size = header->label_offset + label_bytes;
+}
+
+inline void raw_header_init(RawHeader* header, int32_t data_type) {
+    memset(header, 0, sizeof(RawHeader));
+    memcpy(header->magic, LATTE_RAW_MAGIC, 8);
+    header->version = LATTE_RAW_VERSION;
+    header->data_type = data_type;
+    header->data_scale = 1.0f;
+}
+
+// Returns true if file_name starts with the raw format magic
+inline bool is_raw_file(const char* file_name) {
+    FILE* f = fopen(file_name, "rb");
+    if (f == NULL) return false;
+    char magic[8];
+    bool is_raw = fread(magic, 1, 8, f) == 8 && memcmp(magic, LATTE_RAW_MAGIC, 8) == 0;
+    fclose(f);
+    return is_raw;
+}
+
+#endif /* LATTE_IO_RAW_FORMAT_H */
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sample_types.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+static void widen_uint8(float* dst, const uint8_t* src, size_t count, float scale) {
+#pragma omp simd
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+static void widen_half_scalar(float* dst, const uint16_t* src, size_t count, float scale) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = half_to_float(src[i]) * scale;
+    }
+}
+
+#ifdef __x86_64__
+// Compiled for F16C regardless of the build flags, only called after
+// checking the cpu supports it
+__attribute__((target("avx,f16c")))
+static void widen_half_f16c(float* dst, const uint16_t* src, size_t count, float scale) {
+    __m256 s = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtph_ps(h), s));
+    }
+    widen_half_scalar(dst + i, src + i, count - i, scale);
+}
+
+static bool check_f16c() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+}
+
+static bool has_f16c() {
+    static const bool supported = check_f16c();
+    return supported;
+}
+#endif
+
+void widen_samples(float* dst, const void* src, size_t count, int type, float scale) {
+    switch (type) {
+        case SAMPLE_UINT8:
+            widen_uint8(dst, (const uint8_t*) src, count, scale);
+            break;
+        case SAMPLE_FLOAT16:
+#ifdef __x86_64__
+            if (has_f16c()) {
+                widen_half_f16c(dst, (const uint16_t*) src, count, scale);
+                break;
+            }
+#endif
+            widen_half_scalar(dst, (const uint16_t*) src, count, scale);
+            break;
+        default: {
+            const float* f = (const float*) src;
+            if (scale == 1.0f) {
+                memcpy(dst, f, count * sizeof(float));
+            } else {
+#pragma omp simd
+                for (size_t i = 0; i < count; i++) {
+                    dst[i] = f[i] * scale;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_IO_SAMPLE_TYPES_H
+#define LATTE_IO_SAMPLE_TYPES_H
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include "hdf5.h"
+#include "../communication/half.h"
+
+// Storage types supported for the data of a dataset.  Samples are always
+// widened to float when they are gathered into a batch.
+enum SampleType {
+    SAMPLE_FLOAT32 = 0,
+    SAMPLE_UINT8   = 1,
+    SAMPLE_FLOAT16 = 2
+};
+
+inline size_t sample_type_size(int type) {
+    switch (type) {
+        case SAMPLE_FLOAT32: return 4;
+        case SAMPLE_UINT8:   return 1;
+        case SAMPLE_FLOAT16: return 2;
+    }
+    return 0;
+}
+
+// HDF5 memory type matching the in-memory layout of type.  The caller must
+// H5Tclose the returned type.
+inline hid_t sample_hdf5_type(int type) {
+    switch (type) {
+        case SAMPLE_UINT8:
+            return H5Tcopy(H5T_NATIVE_UINT8);
+        case SAMPLE_FLOAT16: {
+            // HDF5 has no predefined half precision type, derive one from
+            // single precision
+            hid_t half = H5Tcopy(H5T_NATIVE_FLOAT);
+            H5Tset_fields(half, 15, 10, 5, 0, 10);
+            H5Tset_size(half, 2);
+            H5Tset_ebias(half, 15);
+            H5Tset_precision(half, 16);
+            return half;
+        }
+        default:
+            return H5Tcopy(H5T_NATIVE_FLOAT);
+    }
+}
+
+// Returns the SampleType matching the HDF5 type of a dataset, -1 if the type
+// is not supported
+inline int sample_type_of(hid_t hdf5_type) {
+    H5T_class_t type_class = H5Tget_class(hdf5_type);
+    size_t size = H5Tget_size(hdf5_type);
+    if (type_class == H5T_FLOAT && size == 4) return SAMPLE_FLOAT32;
+    if (type_class == H5T_FLOAT && size == 2) return SAMPLE_FLOAT16;
+    if (type_class == H5T_INTEGER && size == 1 &&
+            H5Tget_sign(hdf5_type) == H5T_SGN_NONE) return SAMPLE_UINT8;
+    return -1;
+}
+
+// Widen count samples of type from src to float, multiplying by scale
+void widen_samples(float* dst, const void* src, size_t count, int type, float scale);
+
+#endif /* LATTE_IO_SAMPLE_TYPES_H */
@@ -0,0 +1,272 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sequence_dataset.h"
+#ifdef LATTE_BUILD_MPI
+#include "../communication/comm.h"
+#endif
+
+// Read rows [first, first + count) of an HDF5 dataset of shape dims
+static void read_rows(hid_t dataset, hid_t mem_type, int ndim, hsize_t* dims, hsize_t first,
+                      hsize_t count, void* dst) {
+    hsize_t start[ndim];
+    hsize_t counts[ndim];
+    start[0] = first;
+    counts[0] = count;
+    for (int i = 1; i < ndim; i++) {
+        start[i] = 0;
+        counts[i] = dims[i];
+    }
+    hid_t file_dataspace = H5Dget_space(dataset);
+    assert(file_dataspace != -1);
+    herr_t ret = H5Sselect_hyperslab(file_dataspace, H5S_SELECT_SET, start, NULL, counts, NULL);
+    assert(ret != -1);
+    hid_t mem_dataspace = H5Screate_simple(ndim, counts, NULL);
+    assert(mem_dataspace != -1);
+    ret = H5Dread(dataset, mem_type, mem_dataspace, file_dataspace, H5P_DEFAULT, dst);
+    assert(ret != -1);
+    H5Sclose(mem_dataspace);
+    H5Sclose(file_dataspace);
+}
+
+SequenceDataset::SequenceDataset(char* data_file_name, int _batch_size, int _max_steps, bool _shuffle,
+                                 bool use_mpi, int rank, int size, int _bucket_pool,
+                                 unsigned int seed) {
+    debug("Initializing sequence dataset %s.", data_file_name);
+    batch_size = _batch_size;
+    max_steps = _max_steps;
+    shuffle = _shuffle;
+    bucket_pool = _bucket_pool;
+    rng.seed(seed);
+    epoch = 0;
+    curr_batch = 0;
+    batch_steps = 0;
+    data_out = NULL;
+    label_out = NULL;
+    assert(batch_size > 0 && max_steps > 0);
+
+    std::lock_guard<std::mutex> lock(hdf5_mutex);
+    // Every rank reads its own sequences, the file is opened independently
+    hid_t file_id = H5Fopen(data_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        std::cerr << "Error: could not open sequence dataset " << data_file_name << std::endl;
+        assert(false);
+    }
+    hid_t data_dataset_id = H5Dopen2(file_id, "/data", H5P_DEFAULT);
+    assert(data_dataset_id != -1);
+    hid_t label_dataset_id = H5Dopen2(file_id, "/label", H5P_DEFAULT);
+    assert(label_dataset_id != -1);
+    hid_t offsets_dataset_id = H5Dopen2(file_id, "/offsets", H5P_DEFAULT);
+    assert(offsets_dataset_id != -1);
+
+    hid_t space_id = H5Dget_space(offsets_dataset_id);
+    assert(H5Sget_simple_extent_ndims(space_id) == 1);
+    hsize_t num_offsets;
+    H5Sget_simple_extent_dims(space_id, &num_offsets, NULL);
+    H5Sclose(space_id);
+    assert(num_offsets > 1);
+    std::vector<long long> all_offsets(num_offsets);
+    herr_t ret = H5Dread(offsets_dataset_id, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                         all_offsets.data());
+    assert(ret != -1);
+    int total_sequences = num_offsets - 1;
+    long long total_steps = all_offsets.back();
+    for (int i = 0; i < total_sequences; i++) {
+        assert(all_offsets[i] <= all_offsets[i + 1]);
+    }
+
+    int first = 0;
+    int last = total_sequences;
+#ifdef LATTE_BUILD_MPI
+    if (use_mpi) {
+        MPI_Comm_rank(get_inter_net_comm(), &rank);
+        MPI_Comm_size(get_inter_net_comm(), &size);
+    }
+#endif
+    if (size > 1) {
+        first = (long long) rank * total_sequences / size;
+        last = (long long) (rank + 1) * total_sequences / size;
+        debug("Rank %d : sequences %d to %d", rank, first, last);
+    }
+    num_sequences = last - first;
+    long long first_row = all_offsets[first];
+    long long num_rows = all_offsets[last] - first_row;
+    offsets.resize(num_sequences + 1);
+    for (int i = 0; i <= num_sequences; i++) {
+        offsets[i] = all_offsets[first + i] - first_row;
+    }
+
+    space_id = H5Dget_space(data_dataset_id);
+    data_ndim = H5Sget_simple_extent_ndims(space_id);
+    assert(data_ndim > 1);
+    hsize_t data_dims[data_ndim];
+    H5Sget_simple_extent_dims(space_id, data_dims, NULL);
+    H5Sclose(space_id);
+    assert(data_dims[0] == total_steps);
+    data_shape = new int[data_ndim];
+    data_item_size = 1;
+    for (int i = 0; i < data_ndim; i++) {
+        data_shape[i] = data_dims[i];
+        if (i > 0) data_item_size *= data_shape[i];
+    }
+    hid_t type_id = H5Dget_type(data_dataset_id);
+    data_type = sample_type_of(type_id);
+    H5Tclose(type_id);
+    if (data_type < 0) {
+        std::cerr << "Error: unsupported type for /data in " << data_file_name
+                  << ", expected float32, float16 or uint8" << std::endl;
+        assert(false);
+    }
+    data_type_size = sample_type_size(data_type);
+    // Steps are features or token ids rather than pixels, they are only
+    // scaled if the file asks for it
+    data_scale = 1.0f;
+    if (H5Aexists(data_dataset_id, "scale") > 0) {
+        hid_t attr_id = H5Aopen(data_dataset_id, "scale", H5P_DEFAULT);
+        H5Aread(attr_id, H5T_NATIVE_FLOAT, &data_scale);
+        H5Aclose(attr_id);
+    }
+    data_buffer = buffer_arena.acquire<char>((size_t) num_rows * data_item_size * data_type_size);
+    hid_t mem_type = sample_hdf5_type(data_type);
+    read_rows(data_dataset_id, mem_type, data_ndim, data_dims, first_row, num_rows, data_buffer);
+    H5Tclose(mem_type);
+
+    space_id = H5Dget_space(label_dataset_id);
+    label_ndim = H5Sget_simple_extent_ndims(space_id);
+    assert(label_ndim > 1);
+    hsize_t label_dims[label_ndim];
+    H5Sget_simple_extent_dims(space_id, label_dims, NULL);
+    H5Sclose(space_id);
+    if (label_dims[0] != total_sequences && label_dims[0] != total_steps) {
+        std::cerr << "Error: /label of " << data_file_name
+                  << " must have a row per sequence or per step" << std::endl;
+        assert(false);
+    }
+    label_per_step = label_dims[0] != total_sequences;
+    label_shape = new int[label_ndim];
+    label_item_size = 1;
+    for (int i = 0; i < label_ndim; i++) {
+        label_shape[i] = label_dims[i];
+        if (i > 0) label_item_size *= label_shape[i];
+    }
+    if (label_per_step) {
+        label_buffer = buffer_arena.acquire<float>((size_t) num_rows * label_item_size);
+        read_rows(label_dataset_id, H5T_NATIVE_FLOAT, label_ndim, label_dims, first_row, num_rows,
+                  label_buffer);
+    } else {
+        label_buffer = buffer_arena.acquire<float>((size_t) num_sequences * label_item_size);
+        read_rows(label_dataset_id, H5T_NATIVE_FLOAT, label_ndim, label_dims, first, num_sequences,
+                  label_buffer);
+    }
+
+    H5Dclose(offsets_dataset_id);
+    H5Dclose(label_dataset_id);
+    H5Dclose(data_dataset_id);
+    H5Fclose(file_id);
+    debug("%d sequences, %lld steps, labels per step %d", num_sequences, num_rows, label_per_step);
+
+    if (num_sequences < batch_size) {
+        std::cerr << "Error: " << data_file_name << " has fewer sequences than a batch" << std::endl;
+        assert(false);
+    }
+    lengths = new int[batch_size];
+    make_batches();
+}
+
+SequenceDataset::~SequenceDataset() {
+    buffer_arena.release(data_buffer);
+    buffer_arena.release(label_buffer);
+    delete[] data_shape;
+    delete[] label_shape;
+    delete[] lengths;
+}
+
+void SequenceDataset::make_batches() {
+    std::vector<int> seqs(num_sequences);
+    for (int i = 0; i < num_sequences; i++) seqs[i] = i;
+    if (shuffle) std::shuffle(seqs.begin(), seqs.end(), rng);
+    // The last num_sequences % batch_size sequences sit out this epoch
+    int num_batches = num_sequences / batch_size;
+    seqs.resize(num_batches * batch_size);
+    if (bucket_pool > 0) {
+        size_t pool = (size_t) bucket_pool * batch_size;
+        for (size_t start = 0; start < seqs.size(); start += pool) {
+            size_t end = std::min(start + pool, seqs.size());
+            std::stable_sort(seqs.begin() + start, seqs.begin() + end, [this](int a, int b) {
+                return sequence_length(a) < sequence_length(b);
+            });
+        }
+    }
+    batches.swap(seqs);
+    batch_order.resize(num_batches);
+    for (int i = 0; i < num_batches; i++) batch_order[i] = i;
+    if (shuffle) std::shuffle(batch_order.begin(), batch_order.end(), rng);
+    curr_batch = 0;
+}
+
+void SequenceDataset::get_next_batch() {
+    const int* seqs = batches.data() + (size_t) batch_order[curr_batch] * batch_size;
+    batch_steps = 0;
+    for (int i = 0; i < batch_size; i++) {
+        lengths[i] = std::min(sequence_length(seqs[i]), max_steps);
+        batch_steps = std::max(batch_steps, lengths[i]);
+    }
+    size_t item_bytes = (size_t) data_item_size * data_type_size;
+#pragma omp parallel for
+    for (int i = 0; i < batch_size; i++) {
+        long long row = offsets[seqs[i]];
+        for (int t = 0; t < max_steps; t++) {
+            float* out = data_out + ((size_t) t * batch_size + i) * data_item_size;
+            if (t < lengths[i]) {
+                widen_samples(out, data_buffer + (row + t) * item_bytes, data_item_size,
+                              data_type, data_scale);
+            } else {
+                memset(out, 0, data_item_size * sizeof(float));
+            }
+        }
+        if (label_per_step) {
+            for (int t = 0; t < max_steps; t++) {
+                float* out = label_out + ((size_t) t * batch_size + i) * label_item_size;
+                if (t < lengths[i]) {
+                    memcpy(out, label_buffer + (row + t) * label_item_size,
+                           label_item_size * sizeof(float));
+                } else {
+                    memset(out, 0, label_item_size * sizeof(float));
+                }
+            }
+        } else {
+            memcpy(label_out + (size_t) i * label_item_size,
+                   label_buffer + (size_t) seqs[i] * label_item_size,
+                   label_item_size * sizeof(float));
+        }
+    }
+    curr_batch++;
+    if (curr_batch == batch_order.size()) {
+        epoch += 1;
+        make_batches();
+    }
+}
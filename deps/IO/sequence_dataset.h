@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_IO_SEQUENCE_DATASET_H
+#define LATTE_IO_SEQUENCE_DATASET_H
+#include <vector>
+#include "dataset.h"
+
+// Variable length sequences packed back to back in an HDF5 file
+//
+//   /data    (total_steps, ...)   the steps of every sequence
+//   /offsets (num_sequences + 1)  sequence i is rows [offsets[i], offsets[i+1])
+//                                 of /data
+//   /label   (num_sequences, ...) a label per sequence, or
+//            (total_steps, ...)   a label per step, packed like /data
+//
+// Batches are formed by a bucketing batcher: every epoch the sequences are
+// shuffled and cut into pools of bucket_pool batches, each pool is sorted by
+// length and cut into batches, and the batches are shuffled.  Sequences in a
+// batch thus have similar lengths and little of the batch is padding.
+//
+// Batches are laid out time step major, (max_steps, batch_size, item), and
+// are zero past the end of each sequence.  Sequences longer than max_steps
+// are truncated.  batch_steps is the number of steps of the longest
+// sequence of the current batch, steps after it are all padding.
+class SequenceDataset {
+    char* data_buffer;
+    float* label_buffer;
+    int data_type;
+    size_t data_type_size;
+    float data_scale;
+    int data_item_size;
+    int label_item_size;
+    // Rows of this rank's sequences in data_buffer
+    std::vector<long long> offsets;
+    int num_sequences;
+    int batch_size;
+    int max_steps;
+    bool shuffle;
+    int bucket_pool;
+    // batches[b * batch_size, (b + 1) * batch_size) are the sequences of
+    // batch b, consumed in the order of batch_order
+    std::vector<int> batches;
+    std::vector<int> batch_order;
+    int curr_batch;
+    std::mt19937 rng;
+    int sequence_length(int seq) { return offsets[seq + 1] - offsets[seq]; }
+    void make_batches();
+    public:
+        int epoch;
+        int  data_ndim;
+        int* data_shape;
+        int  label_ndim;
+        int* label_shape;
+        bool label_per_step;
+        int batch_steps;
+        // Number of steps of every sequence of the current batch
+        int* lengths;
+        float* data_out;
+        float* label_out;
+        void get_next_batch();
+
+        SequenceDataset(char* data_file_name, int _batch_size, int _max_steps, bool _shuffle,
+                        bool use_mpi, int rank, int size, int _bucket_pool, unsigned int seed);
+        ~SequenceDataset();
+};
+
+#endif /* LATTE_IO_SEQUENCE_DATASET_H */
@@ -0,0 +1,172 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Gradient allreduce time of the comm library's shared memory transport.
+// Forks --procs processes for every process count and reports the time
+// per sync_gradients + wait and the algorithm bandwidth (gradient bytes per
+// second) for every gradient size, in floats.  Needs no MPI.
+//
+// usage: comm_benchmark [--procs=2,<cores>] [--sizes=1024,65536,4194304]
+//                       [--iters=50] [--chunk-size=<bytes>]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+// LatteComm C API, comm.h pulls in MPI when the library is built with it.
+// Its wait clashes with the one of sys/wait.h, which is left out.
+extern "C" {
+    pid_t waitpid(pid_t pid, int* status, int options);
+
+    void init();
+    int init_request();
+    void sync_gradients(float* data, int count, int request_id, int reduce_num);
+    void wait(int request_id);
+    void initialize_communicators(int num_subgroups);
+    void broadcast_inter(float* value, int length, int root);
+}
+
+struct BenchmarkOptions {
+    std::vector<int> procs;
+    std::vector<int> sizes;
+    int iters;
+    std::string chunk_size;
+
+    BenchmarkOptions() : iters(50) {
+        procs.push_back(2);
+        int cores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cores > 2) procs.push_back(cores);
+        sizes.push_back(1024);
+        sizes.push_back(65536);
+        sizes.push_back(4194304);
+    }
+};
+
+static std::vector<int> parse_list(const char* value) {
+    std::vector<int> list;
+    std::istringstream fields(value);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        list.push_back(atoi(field.c_str()));
+    }
+    return list;
+}
+
+static void parse_args(int argc, char** argv, BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* value = strchr(argv[i], '=');
+        value = value == NULL ? "" : value + 1;
+        if (strncmp(argv[i], "--procs=", 8) == 0) {
+            options.procs = parse_list(value);
+        } else if (strncmp(argv[i], "--sizes=", 8) == 0) {
+            options.sizes = parse_list(value);
+        } else if (strncmp(argv[i], "--iters=", 8) == 0) {
+            options.iters = atoi(value);
+        } else if (strncmp(argv[i], "--chunk-size=", 13) == 0) {
+            options.chunk_size = value;
+        } else {
+            std::cerr << "Error: unknown option " << argv[i] << std::endl;
+            exit(1);
+        }
+    }
+    if (options.procs.empty() || options.sizes.empty() || options.iters <= 0) {
+        std::cerr << "Error: invalid options" << std::endl;
+        exit(1);
+    }
+}
+
+// Body of every forked process, rank 0 reports
+static void run_rank(const BenchmarkOptions& options, int run, int rank, int size) {
+    // Every run is a job of its own
+    std::ostringstream job;
+    job << "benchmark_" << getppid() << "_" << run;
+    setenv("LATTE_TRANSPORT", "shm", 1);
+    setenv("LATTE_SHM_JOB", job.str().c_str(), 1);
+    setenv("LATTE_SHM_RANK", std::to_string(rank).c_str(), 1);
+    setenv("LATTE_SHM_SIZE", std::to_string(size).c_str(), 1);
+    if (!options.chunk_size.empty()) setenv("LATTE_SHM_CHUNK_SIZE", options.chunk_size.c_str(), 1);
+    // One core per process
+    omp_set_num_threads(1);
+    init();
+    initialize_communicators(1);
+    int request = init_request();
+    for (int s = 0; s < options.sizes.size(); s++) {
+        int count = options.sizes[s];
+        std::vector<float> gradient(count, 1.0f);
+        for (int i = 0; i < 3; i++) {
+            sync_gradients(&gradient[0], count, request, 1);
+            wait(request);
+        }
+        float start_line = 0.0f;
+        broadcast_inter(&start_line, 1, 0);
+        double start = omp_get_wtime();
+        for (int i = 0; i < options.iters; i++) {
+            sync_gradients(&gradient[0], count, request, 1);
+            wait(request);
+        }
+        double elapsed = (omp_get_wtime() - start) / options.iters;
+        if (rank == 0) {
+            printf("%6d %10d %12.1f %8.3f\n", size, count, elapsed * 1e6,
+                   count * sizeof(float) / elapsed / 1e9);
+            fflush(stdout);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    parse_args(argc, argv, options);
+    printf("%6s %10s %12s %8s\n", "procs", "floats", "us/allreduce", "GB/s");
+    fflush(stdout);
+    for (int p = 0; p < options.procs.size(); p++) {
+        int size = options.procs[p];
+        std::vector<pid_t> children;
+        for (int rank = 0; rank < size; rank++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                run_rank(options, p, rank, size);
+                _exit(0);
+            }
+            children.push_back(pid);
+        }
+        for (int i = 0; i < children.size(); i++) {
+            int status;
+            waitpid(children[i], &status, 0);
+            // Zero for a normal exit with status 0
+            if (status != 0) {
+                std::cerr << "Error: benchmark process failed" << std::endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
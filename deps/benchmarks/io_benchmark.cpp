@@ -0,0 +1,283 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Throughput of the IO library on a synthetic dataset.  Generates an HDF5
+// file of --items items of --shape samples of --type and reports samples/s
+// and GB/s (of stored samples) of get_next_batch for every combination of
+// batch size, OpenMP threads, shuffling and read mode:
+//
+//   memory  the dataset fits in the memory budget and is read once
+//   window  a quarter of the dataset is resident, read slab by slab with
+//           prefetching
+//   stream  batches are streamed item by item in a global permutation
+//
+// usage: io_benchmark [--items=16384] [--shape=3,64,64] [--type=uint8]
+//                     [--batch-sizes=32,128,512] [--threads=1,<max>]
+//                     [--batches=100] [--file=/tmp/latte_io_benchmark.h5]
+//                     [--keep]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include "hdf5.h"
+#include "../IO/sample_types.h"
+#include "../IO/io_stats.h"
+
+// LatteIO C API, io.h defines the library's globals and cannot be included
+extern "C" {
+    void init(bool use_mpi, int rank, int size);
+    void clean_up();
+    int init_dataset(int _batch_size, char *data_file_name, bool _shuffle, bool use_mpi, bool divide_by_rank);
+    void get_next_batch(int dset_id);
+    void set_data_pointer(int dset_id, float* pointer);
+    void set_label_pointer(int dset_id, float* pointer);
+    void set_prefetch(int dset_id, bool enable);
+    void set_memory_budget(size_t bytes);
+    void set_window_slabs(int num_slabs);
+    void set_streaming(bool enable);
+    void set_read_ahead(int num_batches);
+    double get_io_counter(int dset_id, int counter);
+}
+
+struct BenchmarkOptions {
+    int items;
+    std::vector<int> shape;
+    int type;
+    std::vector<int> batch_sizes;
+    std::vector<int> threads;
+    int batches;
+    std::string file;
+    bool keep;
+
+    BenchmarkOptions() : items(16384), type(SAMPLE_UINT8), batches(100),
+                         file("/tmp/latte_io_benchmark.h5"), keep(false) {
+        shape.push_back(3);
+        shape.push_back(64);
+        shape.push_back(64);
+        batch_sizes.push_back(32);
+        batch_sizes.push_back(128);
+        batch_sizes.push_back(512);
+        threads.push_back(1);
+        if (omp_get_max_threads() > 1) threads.push_back(omp_get_max_threads());
+    }
+};
+
+static std::vector<int> parse_list(const char* value) {
+    std::vector<int> list;
+    std::istringstream fields(value);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        list.push_back(atoi(field.c_str()));
+    }
+    return list;
+}
+
+static void parse_args(int argc, char** argv, BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* value = strchr(argv[i], '=');
+        value = value == NULL ? "" : value + 1;
+        if (strncmp(argv[i], "--items=", 8) == 0) {
+            options.items = atoi(value);
+        } else if (strncmp(argv[i], "--shape=", 8) == 0) {
+            options.shape = parse_list(value);
+        } else if (strncmp(argv[i], "--type=", 7) == 0) {
+            if (strcmp(value, "float32") == 0) {
+                options.type = SAMPLE_FLOAT32;
+            } else if (strcmp(value, "float16") == 0) {
+                options.type = SAMPLE_FLOAT16;
+            } else if (strcmp(value, "uint8") == 0) {
+                options.type = SAMPLE_UINT8;
+            } else {
+                std::cerr << "Error: unknown type " << value << std::endl;
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--batch-sizes=", 14) == 0) {
+            options.batch_sizes = parse_list(value);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = parse_list(value);
+        } else if (strncmp(argv[i], "--batches=", 10) == 0) {
+            options.batches = atoi(value);
+        } else if (strncmp(argv[i], "--file=", 7) == 0) {
+            options.file = value;
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            options.keep = true;
+        } else {
+            std::cerr << "Error: unknown option " << argv[i] << std::endl;
+            exit(1);
+        }
+    }
+    if (options.items <= 0 || options.shape.empty() || options.batch_sizes.empty() ||
+            options.threads.empty() || options.batches <= 0) {
+        std::cerr << "Error: invalid options" << std::endl;
+        exit(1);
+    }
+}
+
+// Write items items of pseudo random samples, with the item index as label,
+// a block of items at a time
+static void write_dataset(const BenchmarkOptions& options, size_t item_size) {
+    int ndim = options.shape.size() + 1;
+    hsize_t dims[ndim];
+    dims[0] = options.items;
+    for (int i = 1; i < ndim; i++) dims[i] = options.shape[i - 1];
+    hsize_t label_dims[] = {(hsize_t) options.items, 1};
+
+    hid_t file_id = H5Fcreate(options.file.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    assert(file_id >= 0);
+    hid_t data_space = H5Screate_simple(ndim, dims, NULL);
+    hid_t label_space = H5Screate_simple(2, label_dims, NULL);
+    hid_t data_type = sample_hdf5_type(options.type);
+    hid_t data_id = H5Dcreate(file_id, "data", data_type, data_space,
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t label_id = H5Dcreate(file_id, "label", H5T_NATIVE_FLOAT, label_space,
+                               H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    assert(data_id >= 0 && label_id >= 0);
+
+    const int block = 1024;
+    size_t type_size = sample_type_size(options.type);
+    std::vector<char> data(block * item_size * type_size);
+    std::vector<float> label(block);
+    unsigned int state = 12345;
+    for (int first = 0; first < options.items; first += block) {
+        int count = std::min(block, options.items - first);
+        for (size_t i = 0; i < count * item_size; i++) {
+            state = state * 1103515245 + 12345;
+            float value = (state >> 16) % 256;
+            if (options.type == SAMPLE_UINT8) {
+                data[i] = (uint8_t) value;
+            } else if (options.type == SAMPLE_FLOAT16) {
+                ((uint16_t*) &data[0])[i] = float_to_half(value / 255.0f);
+            } else {
+                ((float*) &data[0])[i] = value / 255.0f;
+            }
+        }
+        for (int i = 0; i < count; i++) label[i] = first + i;
+
+        hsize_t start[ndim];
+        hsize_t count_dims[ndim];
+        for (int i = 0; i < ndim; i++) {
+            start[i] = 0;
+            count_dims[i] = dims[i];
+        }
+        start[0] = first;
+        count_dims[0] = count;
+        hid_t mem_space = H5Screate_simple(ndim, count_dims, NULL);
+        H5Sselect_hyperslab(data_space, H5S_SELECT_SET, start, NULL, count_dims, NULL);
+        herr_t ret = H5Dwrite(data_id, data_type, mem_space, data_space, H5P_DEFAULT, &data[0]);
+        assert(ret >= 0);
+        H5Sclose(mem_space);
+
+        count_dims[1] = 1;
+        mem_space = H5Screate_simple(2, count_dims, NULL);
+        H5Sselect_hyperslab(label_space, H5S_SELECT_SET, start, NULL, count_dims, NULL);
+        ret = H5Dwrite(label_id, H5T_NATIVE_FLOAT, mem_space, label_space, H5P_DEFAULT, &label[0]);
+        assert(ret >= 0);
+        H5Sclose(mem_space);
+    }
+    H5Tclose(data_type);
+    H5Dclose(label_id);
+    H5Dclose(data_id);
+    H5Sclose(label_space);
+    H5Sclose(data_space);
+    H5Fclose(file_id);
+}
+
+enum ReadMode { MODE_MEMORY, MODE_WINDOW, MODE_STREAM };
+static const char* mode_names[] = {"memory", "window", "stream"};
+
+// Time options.batches batches of one configuration, after a few warm up
+// batches.  Returns the elapsed seconds and the fraction of them spent
+// stalled waiting for reads.
+static double run_case(const BenchmarkOptions& options, size_t item_size, ReadMode mode,
+                       bool shuffle, int batch_size, int num_threads, double& stall) {
+    size_t type_size = sample_type_size(options.type);
+    size_t dataset_bytes = (size_t) options.items * (item_size * type_size + sizeof(float));
+    set_streaming(mode == MODE_STREAM);
+    set_read_ahead(2);
+    set_window_slabs(4);
+    set_memory_budget(mode == MODE_WINDOW ? dataset_bytes / 4 : 2 * dataset_bytes);
+    omp_set_num_threads(num_threads);
+
+    int id = init_dataset(batch_size, (char*) options.file.c_str(), shuffle, false, false);
+    std::vector<float> data(batch_size * item_size);
+    std::vector<float> label(batch_size);
+    set_data_pointer(id, &data[0]);
+    set_label_pointer(id, &label[0]);
+    if (mode == MODE_WINDOW) set_prefetch(id, true);
+
+    for (int i = 0; i < 5; i++) get_next_batch(id);
+    double stall_start = get_io_counter(id, IO_STALL_TIME);
+    double start = omp_get_wtime();
+    for (int i = 0; i < options.batches; i++) get_next_batch(id);
+    double elapsed = omp_get_wtime() - start;
+    stall = (get_io_counter(id, IO_STALL_TIME) - stall_start) / elapsed;
+    // Releases the dataset and its buffers before the next case
+    clean_up();
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    parse_args(argc, argv, options);
+    size_t item_size = 1;
+    for (int i = 0; i < options.shape.size(); i++) item_size *= options.shape[i];
+    size_t item_bytes = item_size * sample_type_size(options.type);
+
+    printf("Writing %d items of %zu bytes to %s\n", options.items, item_bytes, options.file.c_str());
+    write_dataset(options, item_size);
+
+    init(false, 0, 1);
+    printf("%-8s %8s %6s %8s %12s %8s %7s\n",
+           "mode", "shuffle", "batch", "threads", "samples/s", "GB/s", "stall");
+    for (int mode = MODE_MEMORY; mode <= MODE_STREAM; mode++) {
+        for (int shuffle = 0; shuffle < 2; shuffle++) {
+            for (int b = 0; b < options.batch_sizes.size(); b++) {
+                for (int t = 0; t < options.threads.size(); t++) {
+                    int batch_size = options.batch_sizes[b];
+                    if (batch_size > options.items) continue;
+                    double stall;
+                    double elapsed = run_case(options, item_size, (ReadMode) mode, shuffle,
+                                              batch_size, options.threads[t], stall);
+                    double samples = (double) options.batches * batch_size;
+                    printf("%-8s %8d %6d %8d %12.0f %8.3f %6.1f%%\n",
+                           mode_names[mode], shuffle, batch_size, options.threads[t],
+                           samples / elapsed, samples * item_bytes / elapsed / 1e9,
+                           100.0 * stall);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    if (!options.keep) remove(options.file.c_str());
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "allreduce.h"
+
+// Sleep between two passes of the progress thread
+#define PROGRESS_INTERVAL_US 20
+
+static MPI_Comm flat_comm = MPI_COMM_NULL;
+// Reduce and broadcast use their own communicators so that each stage is
+// issued in the same order on every rank of a node
+static MPI_Comm node_reduce_comm = MPI_COMM_NULL;
+static MPI_Comm node_bcast_comm = MPI_COMM_NULL;
+// MPI_COMM_NULL on ranks that do not lead their node
+static MPI_Comm leader_comm = MPI_COMM_NULL;
+// Point to point messages of ring allreduces over flat_comm and leader_comm
+static MPI_Comm flat_ring_comm = MPI_COMM_NULL;
+static MPI_Comm leader_ring_comm = MPI_COMM_NULL;
+// Rings started on each ring communicator, their tags
+static int flat_rings = 0;
+static int leader_rings = 0;
+static int node_rank = 0;
+static bool hierarchical = false;
+static int algorithm = ALGORITHM_MPI;
+// Requests in each stage, in the order they entered it
+static std::deque<AllreduceRequest*> stages[ALLREDUCE_STAGES];
+// Guards the requests in flight against the progress thread
+static std::mutex allreduce_mutex;
+// Left running at exit, a joinable std::thread must not be destroyed
+static std::thread* progress_thread = NULL;
+static bool progress_running = false;
+
+void init_allreduce(MPI_Comm comm) {
+    flat_comm = comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_reduce_comm);
+    MPI_Comm_dup(node_reduce_comm, &node_bcast_comm);
+    MPI_Comm_rank(node_reduce_comm, &node_rank);
+    MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, 0, &leader_comm);
+    MPI_Comm_dup(flat_comm, &flat_ring_comm);
+    if (leader_comm != MPI_COMM_NULL) MPI_Comm_dup(leader_comm, &leader_ring_comm);
+}
+
+void set_hierarchical(bool enable) {
+    hierarchical = enable;
+}
+
+void set_algorithm(int _algorithm) {
+    assert(_algorithm == ALGORITHM_MPI || _algorithm == ALGORITHM_RING);
+    algorithm = _algorithm;
+}
+
+static void ring_chunk(AllreduceRequest* request, int size, int chunk, int* begin, int* end) {
+    chunk = ((chunk % size) + size) % size;
+    *begin = (int) ((long) request->count * chunk / size);
+    *end = (int) ((long) request->count * (chunk + 1) / size);
+}
+
+// Post the messages of the ring's current step.  The first size - 1 steps
+// reduce-scatter the data, after which each rank holds the sum of chunk
+// rank + 1, the last size - 1 steps pass the sums around.
+static void post_ring_step(AllreduceRequest* request) {
+    int size, rank;
+    MPI_Comm_size(request->ring_comm, &size);
+    MPI_Comm_rank(request->ring_comm, &rank);
+    int step = request->ring_step;
+    int next = (rank + 1) % size;
+    int prev = (rank + size - 1) % size;
+    int send_begin, send_end, recv_begin, recv_end;
+    float* recv;
+    if (step < size - 1) {
+        ring_chunk(request, size, rank - step, &send_begin, &send_end);
+        ring_chunk(request, size, rank - step - 1, &recv_begin, &recv_end);
+        recv = &request->ring_buffer[0];
+    } else {
+        step -= size - 1;
+        ring_chunk(request, size, rank + 1 - step, &send_begin, &send_end);
+        ring_chunk(request, size, rank - step, &recv_begin, &recv_end);
+        recv = request->data + recv_begin;
+    }
+    MPI_Isend(request->data + send_begin, send_end - send_begin, MPI_FLOAT, next,
+              request->ring_tag, request->ring_comm, &request->ring_requests[0]);
+    MPI_Irecv(recv, recv_end - recv_begin, MPI_FLOAT, prev,
+              request->ring_tag, request->ring_comm, &request->ring_requests[1]);
+}
+
+static void start_ring(AllreduceRequest* request, MPI_Comm comm, int* rings) {
+    int size, rank;
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+    request->ring_comm = comm;
+    request->ring_tag = (*rings)++ % 32768;
+    if (size == 1) {
+        request->ring_step = 2 * (size - 1);
+        request->ring_requests[0] = request->ring_requests[1] = MPI_REQUEST_NULL;
+        return;
+    }
+    // Room for the largest chunk
+    request->ring_buffer.resize(request->count / size + 1);
+    request->ring_step = 0;
+    post_ring_step(request);
+}
+
+// Whether the ring running the request's stage is done, posting its next
+// step if the current one finished
+static bool advance_ring(AllreduceRequest* request) {
+    int size;
+    MPI_Comm_size(request->ring_comm, &size);
+    while (request->ring_step < 2 * (size - 1)) {
+        int done;
+        MPI_Testall(2, request->ring_requests, &done, MPI_STATUSES_IGNORE);
+        if (!done) return false;
+        if (request->ring_step < size - 1) {
+            int rank, begin, end;
+            MPI_Comm_rank(request->ring_comm, &rank);
+            ring_chunk(request, size, rank - request->ring_step - 1, &begin, &end);
+            float* data = request->data;
+            float* recv = &request->ring_buffer[0];
+            for (int i = begin; i < end; i++) {
+                data[i] += recv[i - begin];
+            }
+        }
+        request->ring_step++;
+        if (request->ring_step < 2 * (size - 1)) post_ring_step(request);
+    }
+    return true;
+}
+
+// Issue the communication of the request's stage and queue it
+static void issue(AllreduceRequest* request, int stage) {
+    request->stage = stage;
+    request->ring_step = -1;
+    float* data = request->data;
+    int count = request->count;
+    switch (stage) {
+        case ALLREDUCE_DONE:
+            return;
+        case ALLREDUCE_FLAT:
+            if (algorithm == ALGORITHM_RING) {
+                start_ring(request, flat_ring_comm, &flat_rings);
+            } else {
+                MPI_Iallreduce(MPI_IN_PLACE, data, count, MPI_FLOAT, MPI_SUM, flat_comm,
+                               &request->request);
+            }
+            break;
+        case ALLREDUCE_NODE_REDUCE:
+            MPI_Ireduce(node_rank == 0 ? MPI_IN_PLACE : data, data, count, MPI_FLOAT, MPI_SUM, 0,
+                        node_reduce_comm, &request->request);
+            break;
+        case ALLREDUCE_LEADERS:
+            if (algorithm == ALGORITHM_RING) {
+                start_ring(request, leader_ring_comm, &leader_rings);
+            } else {
+                MPI_Iallreduce(MPI_IN_PLACE, data, count, MPI_FLOAT, MPI_SUM, leader_comm,
+                               &request->request);
+            }
+            break;
+        case ALLREDUCE_NODE_BCAST:
+            MPI_Ibcast(data, count, MPI_FLOAT, 0, node_bcast_comm, &request->request);
+            break;
+    }
+    stages[stage].push_back(request);
+}
+
+static int next_stage(int stage) {
+    switch (stage) {
+        case ALLREDUCE_NODE_REDUCE:
+            return node_rank == 0 ? ALLREDUCE_LEADERS : ALLREDUCE_NODE_BCAST;
+        case ALLREDUCE_LEADERS:
+            return ALLREDUCE_NODE_BCAST;
+        default:
+            return ALLREDUCE_DONE;
+    }
+}
+
+void start_allreduce(float* data, int count, AllreduceRequest* request) {
+    std::lock_guard<std::mutex> lock(allreduce_mutex);
+    assert(flat_comm != MPI_COMM_NULL);
+    request->data = data;
+    request->count = count;
+    issue(request, hierarchical ? ALLREDUCE_NODE_REDUCE : ALLREDUCE_FLAT);
+}
+
+void start_barrier(AllreduceRequest* request) {
+    std::lock_guard<std::mutex> lock(allreduce_mutex);
+    request->data = NULL;
+    request->count = 0;
+    request->stage = ALLREDUCE_FLAT;
+    request->ring_step = -1;
+    MPI_Ibarrier(flat_comm, &request->request);
+    stages[ALLREDUCE_FLAT].push_back(request);
+}
+
+static void progress_locked() {
+    for (int stage = ALLREDUCE_FLAT; stage < ALLREDUCE_STAGES; stage++) {
+        std::deque<AllreduceRequest*>& queue = stages[stage];
+        // Rings do not depend on each other and all move on
+        for (size_t i = 0; i < queue.size(); i++) {
+            if (queue[i]->ring_step >= 0) advance_ring(queue[i]);
+        }
+        // Only the oldest request of a stage moves on to the next, which
+        // keeps the order of the next stage the same on all ranks
+        while (!queue.empty()) {
+            AllreduceRequest* request = queue.front();
+            int done;
+            if (request->ring_step >= 0) {
+                done = advance_ring(request);
+            } else {
+                MPI_Test(&request->request, &done, MPI_STATUS_IGNORE);
+            }
+            if (!done) break;
+            queue.pop_front();
+            issue(request, next_stage(stage));
+        }
+    }
+}
+
+void progress_allreduces() {
+    std::lock_guard<std::mutex> lock(allreduce_mutex);
+    progress_locked();
+}
+
+void wait_allreduce(AllreduceRequest* request) {
+    std::lock_guard<std::mutex> lock(allreduce_mutex);
+    while (request->stage != ALLREDUCE_DONE) {
+        std::deque<AllreduceRequest*>& queue = stages[request->stage];
+        assert(!queue.empty());
+        AllreduceRequest* front = queue.front();
+        if (front->ring_step >= 0) {
+            MPI_Waitall(2, front->ring_requests, MPI_STATUSES_IGNORE);
+        } else {
+            MPI_Wait(&front->request, MPI_STATUS_IGNORE);
+        }
+        progress_locked();
+    }
+}
+
+static void run_progress() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(allreduce_mutex);
+            if (!progress_running) return;
+            progress_locked();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(PROGRESS_INTERVAL_US));
+    }
+}
+
+void enable_progress_thread(bool enable) {
+    {
+        std::lock_guard<std::mutex> lock(allreduce_mutex);
+        if (enable == progress_running) return;
+        progress_running = enable;
+    }
+    if (enable) {
+        progress_thread = new std::thread(run_progress);
+    } else {
+        progress_thread->join();
+        delete progress_thread;
+        progress_thread = NULL;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_ALLREDUCE_H
+#define LATTE_ALLREDUCE_H
+
+#include <vector>
+#include <mpi.h>
+
+// Stage an allreduce is waiting on
+enum AllreduceStage {
+    ALLREDUCE_DONE = 0,
+    // A single allreduce over the inter-net communicator
+    ALLREDUCE_FLAT,
+    // Hierarchical allreduce: sum on the node leader, allreduce among the
+    // node leaders, broadcast from the leader
+    ALLREDUCE_NODE_REDUCE,
+    ALLREDUCE_LEADERS,
+    ALLREDUCE_NODE_BCAST,
+    ALLREDUCE_STAGES
+};
+
+// How the flat and leader allreduces are carried out
+enum AllreduceAlgorithm {
+    ALGORITHM_MPI = 0,
+    // Ring reduce-scatter and allgather over point to point messages,
+    // advanced by progress_allreduces
+    ALGORITHM_RING = 1
+};
+
+// A sum over all inter-net ranks of the floats at data, in place.  The
+// request must stay at the same address until it is done.
+struct AllreduceRequest {
+    MPI_Request request;
+    int stage;
+    float* data;
+    int count;
+    // Step of the ring running the current stage, -1 if MPI runs it
+    int ring_step;
+    int ring_tag;
+    MPI_Comm ring_comm;
+    MPI_Request ring_requests[2];
+    std::vector<float> ring_buffer;
+
+    AllreduceRequest() : stage(ALLREDUCE_DONE), data(NULL), count(0), ring_step(-1) { }
+};
+
+// Split the inter-net communicator by node, collective over comm
+void init_allreduce(MPI_Comm comm);
+// These take effect for allreduces started afterwards, every rank must agree
+void set_hierarchical(bool enable);
+void set_algorithm(int algorithm);
+// A background thread calling progress_allreduces, MPI must have been
+// initialized with MPI_THREAD_MULTIPLE
+void enable_progress_thread(bool enable);
+
+void start_allreduce(float* data, int count, AllreduceRequest* request);
+// A request that completes with a barrier over the inter-net communicator
+void start_barrier(AllreduceRequest* request);
+// Move finished stages of the allreduces in flight on to their next stage
+void progress_allreduces();
+void wait_allreduce(AllreduceRequest* request);
+
+#endif
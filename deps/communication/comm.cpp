@@ -25,104 +25,270 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <string.h>
+#include <string>
+
 #include "comm.h"
+#include "transport.h"
+#include "shm_transport.h"
+#include "trace.h"
+#ifdef LATTE_BUILD_MPI
+#include "mpi_transport.h"
+#endif
+
+Transport *transport = NULL;
+CommTrace trace;
+// Dump of the trace at exit, empty unless LATTE_COMM_TRACE is set
+std::string trace_prefix;
+// Rank the trace is written for, MPI may be finalized at exit
+int trace_rank = 0;
+// Set by set_local_sgd, gradients then stay on the rank computing them
+bool local_sgd = false;
+#ifdef LATTE_BUILD_MPI
+// Same as transport when communicating over MPI, NULL otherwise
+MPITransport *mpi_transport = NULL;
+#endif
 
-std::vector<MPI_Request *> requests;
-MPI_Comm *Inter_net_communicator;
-MPI_Comm *Intra_net_communicator;
+static void dump_trace_at_exit() {
+    trace.dump(trace_prefix.c_str(), trace_rank);
+}
 
+// The transport is chosen by LATTE_TRANSPORT, mpi or shm, and defaults to
+// MPI when the library is built with it.  LATTE_COMM_TRACE=<prefix> traces
+// every call and writes the trace at exit.
 void init() {
-    MPI_Init(NULL, NULL);
+    const char *name = getenv("LATTE_TRANSPORT");
+#ifdef LATTE_BUILD_MPI
+    if (name == NULL || strcmp(name, "mpi") == 0) {
+        mpi_transport = new MPITransport();
+        transport = mpi_transport;
+    }
+#endif
+    if (transport == NULL && (name == NULL || strcmp(name, "shm") == 0)) {
+        transport = new ShmTransport();
+    }
+    if (transport == NULL) {
+        std::cerr << "Error: unknown LATTE_TRANSPORT " << name << std::endl;
+        assert(false);
+    }
+    trace_rank = transport->get_rank();
+    const char *prefix = getenv("LATTE_COMM_TRACE");
+    if (prefix != NULL) {
+        trace_prefix = prefix;
+        trace.set_enabled(true);
+        atexit(dump_trace_at_exit);
+    }
+}
+
+void reduce_threads(float *data, int begin, int end, int count, int reduce_num) {
+#pragma omp parallel for simd
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i < reduce_num; i++) {
+            data[j] += data[i * count + j];
+        }
+    }
+}
+
+static void unsupported(const char *option) {
+    std::cerr << "Warning: " << option << " is not supported by this transport, ignored" << std::endl;
+}
+
+void Transport::set_fusion_bucket_size(size_t bytes) {
+    unsupported("set_fusion_bucket_size");
+}
+
+void Transport::set_segment_size(size_t bytes) {
+    unsupported("set_segment_size");
+}
+
+void Transport::set_hierarchical_allreduce(bool enable) {
+    unsupported("set_hierarchical_allreduce");
+}
+
+void Transport::set_allreduce_algorithm(int algorithm) {
+    unsupported("set_allreduce_algorithm");
+}
+
+void Transport::set_progress_thread(bool enable) {
+    unsupported("set_progress_thread");
+}
+
+void Transport::set_compression(int request_id, int mode, float ratio) {
+    unsupported("set_compression");
+}
+
+static void no_subgroups() {
+    std::cerr << "Error: this transport does not support pipelines between net subgroups" << std::endl;
+    assert(false);
+}
+
+int Transport::open_pipeline(float* data, int item_length, int batch_size,
+                             int num_micro_batches, int tag, int peer, bool send) {
+    no_subgroups();
+    return -1;
+}
+
+void Transport::start_micro_batch(int pipeline, int micro_batch) {
+    no_subgroups();
+}
+
+void Transport::wait_micro_batch(int pipeline, int micro_batch) {
+    no_subgroups();
 }
 
 int init_request() {
-    MPI_Request *request = (MPI_Request *) malloc(sizeof(MPI_Request));
-    // We initialize this request because forward pass begins with a 0 update
-    MPI_Ibarrier(*Inter_net_communicator, request);
-    int id = requests.size();
-    requests.push_back(request);
-    return id;
+    return transport->init_request();
 }
 
 void sync_gradients(float *data, int count, int request_id, int reduce_num) {
-    if (reduce_num > 1) {
+    double start = trace.begin();
+    if (local_sgd) {
+        if (reduce_num > 1) {
+            reduce_threads(data, 0, count, count, reduce_num);
+        }
+        // Scaled like the sum over ranks it stands in for, the learning rate
+        // means the same with and without local steps
+        float scale = transport->get_inter_size();
 #pragma omp parallel for simd
-        for (int j = 0; j < count; j++) {
-            for (int i = 1; i < reduce_num; i++) {
-                data[j] += data[i * count + j];
-            }
+        for (int i = 0; i < count; i++) {
+            data[i] *= scale;
         }
+        trace.call("sync_gradients", start, request_id, 0, -1);
+        return;
     }
-    MPI_Request *request = requests[request_id];
-    MPI_Iallreduce(MPI_IN_PLACE, data, count, MPI_FLOAT, MPI_SUM, *Inter_net_communicator, request);
-    // int size;
-    // MPI_Comm_size(MPI_COMM_WORLD, &size);
-    // Scale for gradient accumulation normalization
-    // #pragma omp parallel for simd
-    // for (int i=0; i < count; i++) {
-    //     data[i] /= (float) size;
-    // }
+    transport->sync_gradients(data, count, request_id, reduce_num);
+    trace.issue(request_id, count * sizeof(float), start);
 }
 
 void wait(int request_id) {
-    MPI_Request *request = requests[request_id];
-    // clock_t start_time = clock();
-    MPI_Wait(request, MPI_STATUS_IGNORE);
-    // clock_t end_time = clock();
-    // double total_time = ((double) (end_time - start_time)) / CLOCKS_PER_SEC;
-    // std::cout << "Parameter " << request_id << " takes " << total_time << " seconds." << std::endl;
+    double start = trace.begin();
+    transport->wait(request_id);
+    trace.complete(request_id, start);
+}
+
+void flush_gradients() {
+    double start = trace.begin();
+    transport->flush_gradients();
+    trace.call("flush_gradients", start, -1, 0, -1);
+}
+
+// Every rank steps on its own gradients, multiplied by the number of ranks,
+// and the replicas drift apart until average_parameters is called.  Gradients already in flight still complete
+// in wait.
+void set_local_sgd(bool enable) {
+    local_sgd = enable;
+}
+
+void average_parameters(float* data, int count) {
+    double start = trace.begin();
+    transport->average_parameters(data, count);
+    trace.call("average_parameters", start, -1, count * sizeof(float), -1);
+}
+
+void set_fusion_bucket_size(size_t bytes) {
+    transport->set_fusion_bucket_size(bytes);
+}
+
+void set_segment_size(size_t bytes) {
+    transport->set_segment_size(bytes);
+}
+
+void set_hierarchical_allreduce(bool enable) {
+    transport->set_hierarchical_allreduce(enable);
+}
+
+void set_allreduce_algorithm(int algorithm) {
+    transport->set_allreduce_algorithm(algorithm);
+}
+
+void set_progress_thread(bool enable) {
+    transport->set_progress_thread(enable);
+}
+
+void set_compression(int request_id, int mode, float ratio) {
+    transport->set_compression(request_id, mode, ratio);
 }
 
 float reduce_accuracy(float acc) {
-    MPI_Comm comm = *Inter_net_communicator;
-    int size, rank;
-    MPI_Comm_size(comm, &size);
-    MPI_Comm_rank(comm, &rank);  
-    float total_acc = 0.0f;
-    MPI_Reduce(&acc, &total_acc, 1, MPI_FLOAT, MPI_SUM, 0, comm);
-    if (rank == 0) {
-        return total_acc / size;
-    } else {
-        return -1.0f;
-    }
+    double start = trace.begin();
+    float total_acc = transport->reduce_accuracy(acc);
+    trace.call("reduce_accuracy", start, -1, sizeof(float), -1);
+    return total_acc;
 }
 
 void broadcast_inter(float* value, int length, int root) {
-    MPI_Bcast(value, length, MPI_FLOAT, root, *Inter_net_communicator);
+    double start = trace.begin();
+    transport->broadcast_inter(value, length, root);
+    trace.call("broadcast_inter", start, -1, length * sizeof(float), root);
 }
 
 void broadcast_intra(float* value, int length, int root) {
-    MPI_Bcast(value, length, MPI_FLOAT, root, *Intra_net_communicator);
+    double start = trace.begin();
+    transport->broadcast_intra(value, length, root);
+    trace.call("broadcast_intra", start, -1, length * sizeof(float), root);
 }
 
 int get_rank() {
-    int rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    return rank;
+    return transport->get_rank();
+}
+
+int get_size() {
+    return transport->get_size();
 }
 
 void initialize_communicators(int num_subgroups) {
-    int size, rank;
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    assert(size % num_subgroups == 0);
-    Intra_net_communicator = (MPI_Comm *) malloc(sizeof(MPI_Comm));
-    Inter_net_communicator = (MPI_Comm *) malloc(sizeof(MPI_Comm));
-    // Initialize for each net replica
-    MPI_Comm_split(MPI_COMM_WORLD, rank % num_subgroups, 0, Inter_net_communicator);
-    MPI_Comm_split(MPI_COMM_WORLD, rank / num_subgroups, 0, Intra_net_communicator);
+    transport->initialize_communicators(num_subgroups);
 }
 
 void recv_intra(float* data, int length, int tag, int source) {
-    // std::cout << "Receiving " << length << " floats with tag " << tag << " from " << source << std::endl;
-    MPI_Recv(data, length, MPI_FLOAT, source, tag, *Intra_net_communicator, MPI_STATUS_IGNORE);
+    double start = trace.begin();
+    transport->recv_intra(data, length, tag, source);
+    trace.call("recv_intra", start, -1, length * sizeof(float), source);
 }
 
 void send_intra(float* data, int length, int tag, int dest) {
-    // std::cout << "Sending " << length << " floats with tag " << tag << " to " << dest << std::endl;
-    MPI_Send(data, length, MPI_FLOAT, dest, tag, *Intra_net_communicator);
+    double start = trace.begin();
+    transport->send_intra(data, length, tag, dest);
+    trace.call("send_intra", start, -1, length * sizeof(float), dest);
+}
+
+int open_pipeline(float* data, int item_length, int batch_size, int num_micro_batches,
+                  int tag, int peer, bool send) {
+    return transport->open_pipeline(data, item_length, batch_size, num_micro_batches,
+                                    tag, peer, send);
+}
+
+void start_micro_batch(int pipeline, int micro_batch) {
+    double start = trace.begin();
+    transport->start_micro_batch(pipeline, micro_batch);
+    trace.call("start_micro_batch", start, -1, 0, -1);
+}
+
+void wait_micro_batch(int pipeline, int micro_batch) {
+    double start = trace.begin();
+    transport->wait_micro_batch(pipeline, micro_batch);
+    trace.call("wait_micro_batch", start, -1, 0, -1);
+}
+
+void set_comm_trace(bool enable) {
+    trace.set_enabled(enable);
+}
+
+void dump_comm_trace(char* prefix) {
+    trace.dump(prefix, trace_rank);
+}
+
+void clear_comm_trace() {
+    trace.clear();
+}
+
+void set_comm_trace_capacity(size_t num_events) {
+    trace.set_capacity(num_events);
 }
 
+#ifdef LATTE_BUILD_MPI
 MPI_Comm get_inter_net_comm() {
-    return *Inter_net_communicator;
+    assert(mpi_transport != NULL);
+    return mpi_transport->inter_net_comm();
 }
+#endif
@@ -29,20 +29,43 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ctime>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <assert.h>
+#ifdef LATTE_BUILD_MPI
 #include <mpi.h>
+#endif
 
 extern "C" {
     void init();
     int init_request();
     void sync_gradients(float* data, int count, int request_id, int reduce_num);
     void wait(int request_id);
+    void flush_gradients();
+    void set_local_sgd(bool enable);
+    void average_parameters(float* data, int count);
+    void set_fusion_bucket_size(size_t bytes);
+    void set_segment_size(size_t bytes);
+    void set_hierarchical_allreduce(bool enable);
+    void set_allreduce_algorithm(int algorithm);
+    void set_progress_thread(bool enable);
+    void set_compression(int request_id, int mode, float ratio);
     float reduce_accuracy(float acc);
     int get_rank();
+    int get_size();
     void initialize_communicators(int num_subgroups);
     void broadcast_intra(float* value, int length, int root);
     void broadcast_inter(float* value, int length, int root);
     void recv_intra(float* data, int length, int tag, int source);
     void send_intra(float* data, int length, int tag, int dest);
+    int  open_pipeline(float* data, int item_length, int batch_size, int num_micro_batches,
+                       int tag, int peer, bool send);
+    void start_micro_batch(int pipeline, int micro_batch);
+    void wait_micro_batch(int pipeline, int micro_batch);
+    void set_comm_trace(bool enable);
+    void dump_comm_trace(char* prefix);
+    void clear_comm_trace();
+    void set_comm_trace_capacity(size_t num_events);
+#ifdef LATTE_BUILD_MPI
     MPI_Comm get_inter_net_comm();
+#endif
 }
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "compression.h"
+#include "half.h"
+
+static void sum_halves(void* in, void* inout, int* len, MPI_Datatype* type) {
+    uint16_t* a = (uint16_t*) in;
+    uint16_t* b = (uint16_t*) inout;
+    for (int i = 0; i < *len; i++) {
+        b[i] = float_to_half(half_to_float(a[i]) + half_to_float(b[i]));
+    }
+}
+
+GradientCompression::GradientCompression() {
+    half_type = MPI_DATATYPE_NULL;
+    half_sum = MPI_OP_NULL;
+}
+
+void GradientCompression::set_mode(int request_id, int mode, float ratio) {
+    assert(mode >= COMPRESS_NONE && mode <= COMPRESS_TOPK);
+    assert(mode != COMPRESS_TOPK || (ratio > 0.0f && ratio <= 1.0f));
+    assert(!contains(request_id));
+    if (mode == COMPRESS_NONE) {
+        gradients.erase(request_id);
+        return;
+    }
+    if (mode == COMPRESS_FP16 && half_type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(sizeof(uint16_t), MPI_BYTE, &half_type);
+        MPI_Type_commit(&half_type);
+        MPI_Op_create(sum_halves, 1, &half_sum);
+    }
+    CompressedGradient& gradient = gradients[request_id];
+    gradient.mode = mode;
+    gradient.ratio = ratio;
+    gradient.pending = false;
+    gradient.residual.clear();
+}
+
+bool GradientCompression::compresses(int request_id) const {
+    return gradients.find(request_id) != gradients.end();
+}
+
+void GradientCompression::start(int request_id, float* data, int count, MPI_Comm comm) {
+    CompressedGradient& gradient = gradients[request_id];
+    assert(!gradient.pending);
+    gradient.data = data;
+    gradient.count = count;
+    gradient.pending = true;
+    if (gradient.mode == COMPRESS_FP16) {
+        gradient.half.resize(count);
+        uint16_t* half = &gradient.half[0];
+#pragma omp parallel for simd
+        for (int i = 0; i < count; i++) {
+            half[i] = float_to_half(data[i]);
+        }
+        MPI_Iallreduce(MPI_IN_PLACE, half, count, half_type, half_sum, comm, &gradient.request);
+        return;
+    }
+    // Error feedback: entries left out of earlier steps are added back
+    // before choosing the largest ones
+    std::vector<float>& residual = gradient.residual;
+    if ((int) residual.size() != count) residual.assign(count, 0.0f);
+#pragma omp parallel for simd
+    for (int i = 0; i < count; i++) {
+        residual[i] += data[i];
+    }
+    int k = std::max(1, (int) (gradient.ratio * count));
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++) order[i] = i;
+    std::nth_element(order.begin(), order.begin() + (k - 1), order.end(),
+                     [&residual](int a, int b) { return fabsf(residual[a]) > fabsf(residual[b]); });
+    gradient.sparse.resize(k);
+    for (int i = 0; i < k; i++) {
+        gradient.sparse[i].value = residual[order[i]];
+        gradient.sparse[i].index = order[i];
+        residual[order[i]] = 0.0f;
+    }
+    int size;
+    MPI_Comm_size(comm, &size);
+    gradient.gathered.resize((size_t) size * k);
+    MPI_Iallgather(&gradient.sparse[0], k, MPI_FLOAT_INT, &gradient.gathered[0], k,
+                   MPI_FLOAT_INT, comm, &gradient.request);
+}
+
+bool GradientCompression::contains(int request_id) const {
+    std::map<int, CompressedGradient>::const_iterator it = gradients.find(request_id);
+    return it != gradients.end() && it->second.pending;
+}
+
+void GradientCompression::wait(int request_id) {
+    CompressedGradient& gradient = gradients[request_id];
+    assert(gradient.pending);
+    MPI_Wait(&gradient.request, MPI_STATUS_IGNORE);
+    gradient.pending = false;
+    float* data = gradient.data;
+    int count = gradient.count;
+    if (gradient.mode == COMPRESS_FP16) {
+        uint16_t* half = &gradient.half[0];
+#pragma omp parallel for simd
+        for (int i = 0; i < count; i++) {
+            data[i] = half_to_float(half[i]);
+        }
+        return;
+    }
+    memset(data, 0, count * sizeof(float));
+    for (size_t i = 0; i < gradient.gathered.size(); i++) {
+        data[gradient.gathered[i].index] += gradient.gathered[i].value;
+    }
+}
@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_COMPRESSION_H
+#define LATTE_COMPRESSION_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <mpi.h>
+
+enum CompressionMode {
+    COMPRESS_NONE = 0,
+    // Gradients are sent and summed as IEEE half floats
+    COMPRESS_FP16 = 1,
+    // Only the largest entries are sent, the rest is carried to the next step
+    COMPRESS_TOPK = 2
+};
+
+// Layout of MPI_FLOAT_INT
+struct SparseEntry {
+    float value;
+    int index;
+};
+
+// Compression state of one parameter
+struct CompressedGradient {
+    int mode;
+    float ratio;                       // fraction of entries sent by COMPRESS_TOPK
+    std::vector<float> residual;       // entries of past gradients not sent yet
+    std::vector<uint16_t> half;
+    std::vector<SparseEntry> sparse;
+    std::vector<SparseEntry> gathered;
+    float* data;
+    int count;
+    bool pending;
+    MPI_Request request;
+};
+
+// Exchanges the gradients of the parameters it is enabled for in a
+// compressed form.  Like uncompressed gradients, the sum over ranks is
+// written back to the gradient when wait is called.
+class GradientCompression {
+  public:
+    GradientCompression();
+
+    void set_mode(int request_id, int mode, float ratio);
+    bool compresses(int request_id) const;
+    void start(int request_id, float* data, int count, MPI_Comm comm);
+    bool contains(int request_id) const;
+    void wait(int request_id);
+
+  private:
+    MPI_Datatype half_type;
+    MPI_Op half_sum;
+    std::map<int, CompressedGradient> gradients;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <string.h>
+
+#include "fusion.h"
+
+GradientFusion::GradientFusion() {
+    bucket_floats = DEFAULT_FUSION_BUCKET_SIZE / sizeof(float);
+    open_bucket = -1;
+}
+
+void GradientFusion::set_bucket_size(size_t bytes) {
+    // Buckets in flight keep their buffers, new buckets use the new size
+    flush();
+    bucket_floats = bytes / sizeof(float);
+}
+
+int GradientFusion::free_bucket() {
+    for (int i = 0; i < (int) buckets.size(); i++) {
+        if (!buckets[i].launched && buckets[i].used == 0 &&
+                buckets[i].buffer.size() == bucket_floats) {
+            return i;
+        }
+    }
+    FusionBucket bucket;
+    bucket.buffer.resize(bucket_floats);
+    bucket.used = 0;
+    bucket.pending = 0;
+    bucket.launched = false;
+    bucket.request.stage = ALLREDUCE_DONE;
+    buckets.push_back(bucket);
+    return buckets.size() - 1;
+}
+
+bool GradientFusion::fuses(int count) const {
+    // Gradients filling a bucket on their own gain nothing from packing
+    return (size_t) count < bucket_floats;
+}
+
+bool GradientFusion::add(int request_id, float* data, int count) {
+    if (!fuses(count)) return false;
+    assert(fused.find(request_id) == fused.end());
+    if (open_bucket >= 0 && buckets[open_bucket].used + count > bucket_floats) flush();
+    if (open_bucket < 0) open_bucket = free_bucket();
+    FusionBucket& bucket = buckets[open_bucket];
+    FusedGradient gradient;
+    gradient.data = data;
+    gradient.count = count;
+    gradient.offset = bucket.used;
+    gradient.bucket = open_bucket;
+    memcpy(&bucket.buffer[bucket.used], data, count * sizeof(float));
+    bucket.used += count;
+    bucket.pending++;
+    fused[request_id] = gradient;
+    if (bucket.used == bucket_floats) flush();
+    return true;
+}
+
+void GradientFusion::flush() {
+    if (open_bucket < 0) return;
+    FusionBucket& bucket = buckets[open_bucket];
+    start_allreduce(&bucket.buffer[0], bucket.used, &bucket.request);
+    bucket.launched = true;
+    open_bucket = -1;
+}
+
+bool GradientFusion::contains(int request_id) const {
+    return fused.find(request_id) != fused.end();
+}
+
+void GradientFusion::wait(int request_id) {
+    std::map<int, FusedGradient>::iterator it = fused.find(request_id);
+    assert(it != fused.end());
+    FusedGradient gradient = it->second;
+    fused.erase(it);
+    // The last bucket of a backward pass rarely fills
+    if (gradient.bucket == open_bucket) flush();
+    FusionBucket& bucket = buckets[gradient.bucket];
+    wait_allreduce(&bucket.request);
+    memcpy(gradient.data, &bucket.buffer[gradient.offset], gradient.count * sizeof(float));
+    if (--bucket.pending == 0) {
+        bucket.used = 0;
+        bucket.launched = false;
+    }
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_FUSION_H
+#define LATTE_FUSION_H
+
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "allreduce.h"
+
+// Bucket size used unless set_fusion_bucket_size is called, in bytes.  Off,
+// gradients are reduced on their own.
+#define DEFAULT_FUSION_BUCKET_SIZE 0
+
+// A fixed-size buffer holding consecutive gradients that are reduced by a
+// single allreduce
+struct FusionBucket {
+    std::vector<float> buffer;
+    size_t used;           // floats packed so far
+    int pending;           // packed gradients not yet waited for
+    bool launched;
+    AllreduceRequest request;
+};
+
+// Location of a gradient packed into a bucket
+struct FusedGradient {
+    float* data;
+    int count;
+    size_t offset;
+    int bucket;
+};
+
+// Packs the gradients passed to sync_gradients into buckets and launches one
+// allreduce per bucket as soon as it fills.  Gradients stay packed until
+// wait is called for their request, which copies back the reduced values.
+// Every rank must add the same gradients in the same order.
+class GradientFusion {
+  public:
+    GradientFusion();
+
+    // Bucket size in bytes, 0 disables fusion
+    void set_bucket_size(size_t bytes);
+
+    // Whether gradients of count floats are packed into buckets
+    bool fuses(int count) const;
+    // Returns false if the gradient is not fused and must be reduced alone
+    bool add(int request_id, float* data, int count);
+    // Launch the partially filled bucket, if any
+    void flush();
+    bool contains(int request_id) const;
+    void wait(int request_id);
+
+  private:
+    int free_bucket();
+
+    size_t bucket_floats;
+    int open_bucket;
+    // Buckets in flight must not move
+    std::deque<FusionBucket> buckets;
+    std::map<int, FusedGradient> fused;
+};
+
+#endif
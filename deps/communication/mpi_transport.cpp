@@ -0,0 +1,284 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+#include "mpi_transport.h"
+
+MPITransport::MPITransport() {
+    Inter_net_communicator = NULL;
+    Intra_net_communicator = NULL;
+    pipeline_comm = MPI_COMM_NULL;
+    segment_floats = 0;
+    thread_support = MPI_THREAD_SINGLE;
+    MPI_Init_thread(NULL, NULL, requested_thread_level(), &thread_support);
+}
+
+// MPI calls come from the main thread unless LATTE_MPI_THREADS=multiple,
+// which the progress thread and background MPI-IO reads need.  The higher
+// level makes every MPI call pay for locking on some implementations.
+int MPITransport::requested_thread_level() {
+    const char *level = getenv("LATTE_MPI_THREADS");
+    if (level == NULL || strcmp(level, "funneled") == 0) return MPI_THREAD_FUNNELED;
+    if (strcmp(level, "single") == 0) return MPI_THREAD_SINGLE;
+    if (strcmp(level, "serialized") == 0) return MPI_THREAD_SERIALIZED;
+    if (strcmp(level, "multiple") == 0) return MPI_THREAD_MULTIPLE;
+    std::cerr << "Error: unknown LATTE_MPI_THREADS " << level << std::endl;
+    assert(false);
+    return MPI_THREAD_FUNNELED;
+}
+
+int MPITransport::init_request() {
+    AllreduceRequest *request = new AllreduceRequest();
+    // We initialize this request because forward pass begins with a 0 update
+    start_barrier(request);
+    int id = requests.size();
+    requests.push_back(request);
+    segment_requests.push_back(std::vector<AllreduceRequest>());
+    return id;
+}
+
+// Reduce the thread copies a segment at a time, starting the allreduce of
+// each segment before reducing the next one
+void MPITransport::sync_segments(float *data, int count, int request_id, int reduce_num) {
+    std::vector<AllreduceRequest>& pending = segment_requests[request_id];
+    // Sized up front, requests in flight must not move
+    pending.resize((count + segment_floats - 1) / segment_floats);
+    for (size_t i = 0; i < pending.size(); i++) {
+        int begin = i * segment_floats;
+        int end = std::min(count, begin + (int) segment_floats);
+        reduce_threads(data, begin, end, count, reduce_num);
+        start_allreduce(data + begin, end - begin, &pending[i]);
+        // Give the segments in flight a chance to progress
+        progress_allreduces();
+    }
+}
+
+void MPITransport::sync_gradients(float *data, int count, int request_id, int reduce_num) {
+    if (compression.compresses(request_id)) {
+        if (reduce_num > 1) {
+            reduce_threads(data, 0, count, count, reduce_num);
+        }
+        compression.start(request_id, data, count, *Inter_net_communicator);
+        return;
+    }
+    if (reduce_num > 1 && segment_floats > 0 && (size_t) count > segment_floats &&
+            !fusion.fuses(count)) {
+        sync_segments(data, count, request_id, reduce_num);
+        return;
+    }
+    if (reduce_num > 1) {
+        reduce_threads(data, 0, count, count, reduce_num);
+    }
+    // Small gradients are packed with their neighbours and reduced together
+    if (fusion.add(request_id, data, count)) return;
+    start_allreduce(data, count, requests[request_id]);
+    // int size;
+    // MPI_Comm_size(MPI_COMM_WORLD, &size);
+    // Scale for gradient accumulation normalization
+    // #pragma omp parallel for simd
+    // for (int i=0; i < count; i++) {
+    //     data[i] /= (float) size;
+    // }
+}
+
+void MPITransport::wait(int request_id) {
+    if (compression.contains(request_id)) {
+        compression.wait(request_id);
+        return;
+    }
+    if (fusion.contains(request_id)) {
+        fusion.wait(request_id);
+        return;
+    }
+    std::vector<AllreduceRequest>& segments = segment_requests[request_id];
+    for (size_t i = 0; i < segments.size(); i++) {
+        wait_allreduce(&segments[i]);
+    }
+    segments.clear();
+    wait_allreduce(requests[request_id]);
+}
+
+void MPITransport::flush_gradients() {
+    fusion.flush();
+}
+
+void MPITransport::average_parameters(float* data, int count) {
+    // Summed by the same allreduce as gradients, hierarchical or ring if set
+    AllreduceRequest request;
+    start_allreduce(data, count, &request);
+    wait_allreduce(&request);
+    int size;
+    MPI_Comm_size(*Inter_net_communicator, &size);
+    float scale = 1.0f / size;
+#pragma omp parallel for simd
+    for (int i = 0; i < count; i++) {
+        data[i] *= scale;
+    }
+}
+
+void MPITransport::set_fusion_bucket_size(size_t bytes) {
+    fusion.set_bucket_size(bytes);
+}
+
+void MPITransport::set_segment_size(size_t bytes) {
+    segment_floats = bytes / sizeof(float);
+}
+
+void MPITransport::set_hierarchical_allreduce(bool enable) {
+    set_hierarchical(enable);
+}
+
+void MPITransport::set_allreduce_algorithm(int algorithm) {
+    set_algorithm(algorithm);
+}
+
+void MPITransport::set_progress_thread(bool enable) {
+    if (enable && thread_support < MPI_THREAD_MULTIPLE) {
+        std::cerr << "Warning: MPI lacks MPI_THREAD_MULTIPLE (set LATTE_MPI_THREADS=multiple), "
+                  << "gradients progress only in wait" << std::endl;
+        return;
+    }
+    enable_progress_thread(enable);
+}
+
+void MPITransport::set_compression(int request_id, int mode, float ratio) {
+    compression.set_mode(request_id, mode, ratio);
+}
+
+float MPITransport::reduce_accuracy(float acc) {
+    MPI_Comm comm = *Inter_net_communicator;
+    int size, rank;
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);  
+    float total_acc = 0.0f;
+    MPI_Reduce(&acc, &total_acc, 1, MPI_FLOAT, MPI_SUM, 0, comm);
+    if (rank == 0) {
+        return total_acc / size;
+    } else {
+        return -1.0f;
+    }
+}
+
+void MPITransport::broadcast_inter(float* value, int length, int root) {
+    MPI_Bcast(value, length, MPI_FLOAT, root, *Inter_net_communicator);
+}
+
+void MPITransport::broadcast_intra(float* value, int length, int root) {
+    MPI_Bcast(value, length, MPI_FLOAT, root, *Intra_net_communicator);
+}
+
+int MPITransport::get_rank() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+}
+
+int MPITransport::get_size() {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    return size;
+}
+
+int MPITransport::get_inter_size() {
+    int size;
+    MPI_Comm_size(*Inter_net_communicator, &size);
+    return size;
+}
+
+void MPITransport::initialize_communicators(int num_subgroups) {
+    int size, rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    assert(size % num_subgroups == 0);
+    Intra_net_communicator = (MPI_Comm *) malloc(sizeof(MPI_Comm));
+    Inter_net_communicator = (MPI_Comm *) malloc(sizeof(MPI_Comm));
+    // Initialize for each net replica
+    MPI_Comm_split(MPI_COMM_WORLD, rank % num_subgroups, 0, Inter_net_communicator);
+    MPI_Comm_split(MPI_COMM_WORLD, rank / num_subgroups, 0, Intra_net_communicator);
+    MPI_Comm_dup(*Intra_net_communicator, &pipeline_comm);
+    init_allreduce(*Inter_net_communicator);
+}
+
+void MPITransport::recv_intra(float* data, int length, int tag, int source) {
+    // std::cout << "Receiving " << length << " floats with tag " << tag << " from " << source << std::endl;
+    MPI_Recv(data, length, MPI_FLOAT, source, tag, *Intra_net_communicator, MPI_STATUS_IGNORE);
+}
+
+void MPITransport::send_intra(float* data, int length, int tag, int dest) {
+    // std::cout << "Sending " << length << " floats with tag " << tag << " to " << dest << std::endl;
+    MPI_Send(data, length, MPI_FLOAT, dest, tag, *Intra_net_communicator);
+}
+
+int MPITransport::open_pipeline(float* data, int item_length, int batch_size,
+                                int num_micro_batches, int tag, int peer, bool send) {
+    assert(num_micro_batches > 0 && num_micro_batches <= batch_size);
+    MicroBatchPipeline pipeline;
+    pipeline.data = data;
+    pipeline.item_length = item_length;
+    pipeline.batch_size = batch_size;
+    pipeline.num_micro_batches = num_micro_batches;
+    pipeline.tag = tag;
+    pipeline.peer = peer;
+    pipeline.send = send;
+    for (int i = 0; i < 2; i++) {
+        pipeline.slots[i] = MPI_REQUEST_NULL;
+        pipeline.slot_micro_batch[i] = -1;
+    }
+    pipelines.push_back(pipeline);
+    return pipelines.size() - 1;
+}
+
+void MPITransport::start_micro_batch(int id, int micro_batch) {
+    MicroBatchPipeline& pipeline = pipelines[id];
+    assert(micro_batch >= 0 && micro_batch < pipeline.num_micro_batches);
+    int slot = micro_batch % 2;
+    // The slot's previous micro-batch must have left or arrived
+    MPI_Wait(&pipeline.slots[slot], MPI_STATUS_IGNORE);
+    int begin = (int) ((long) pipeline.batch_size * micro_batch / pipeline.num_micro_batches);
+    int end = (int) ((long) pipeline.batch_size * (micro_batch + 1) / pipeline.num_micro_batches);
+    float* data = pipeline.data + (size_t) begin * pipeline.item_length;
+    int length = (end - begin) * pipeline.item_length;
+    int tag = pipeline.tag * pipeline.num_micro_batches + micro_batch;
+    if (pipeline.send) {
+        MPI_Isend(data, length, MPI_FLOAT, pipeline.peer, tag, pipeline_comm, &pipeline.slots[slot]);
+    } else {
+        MPI_Irecv(data, length, MPI_FLOAT, pipeline.peer, tag, pipeline_comm, &pipeline.slots[slot]);
+    }
+    pipeline.slot_micro_batch[slot] = micro_batch;
+}
+
+void MPITransport::wait_micro_batch(int id, int micro_batch) {
+    MicroBatchPipeline& pipeline = pipelines[id];
+    int slot = micro_batch % 2;
+    assert(pipeline.slot_micro_batch[slot] == micro_batch);
+    MPI_Wait(&pipeline.slots[slot], MPI_STATUS_IGNORE);
+}
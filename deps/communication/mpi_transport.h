@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_MPI_TRANSPORT_H
+#define LATTE_MPI_TRANSPORT_H
+
+#include <vector>
+#include <mpi.h>
+
+#include "transport.h"
+#include "allreduce.h"
+#include "fusion.h"
+#include "compression.h"
+
+// A batch buffer sent or received a micro-batch at a time, double buffered
+struct MicroBatchPipeline {
+    float* data;
+    int item_length;
+    int batch_size;
+    int num_micro_batches;
+    int tag;
+    int peer;
+    bool send;
+    // Transfers in flight and their micro-batch, -1 if none
+    MPI_Request slots[2];
+    int slot_micro_batch[2];
+};
+
+// Transport over MPI, for any number of hosts
+class MPITransport : public Transport {
+  public:
+    MPITransport();
+
+    int get_rank();
+    int get_size();
+    int get_inter_size();
+    void initialize_communicators(int num_subgroups);
+
+    int init_request();
+    void sync_gradients(float* data, int count, int request_id, int reduce_num);
+    void wait(int request_id);
+    void average_parameters(float* data, int count);
+    void flush_gradients();
+
+    float reduce_accuracy(float acc);
+    void broadcast_inter(float* value, int length, int root);
+    void broadcast_intra(float* value, int length, int root);
+    void recv_intra(float* data, int length, int tag, int source);
+    void send_intra(float* data, int length, int tag, int dest);
+
+    int open_pipeline(float* data, int item_length, int batch_size,
+                      int num_micro_batches, int tag, int peer, bool send);
+    void start_micro_batch(int pipeline, int micro_batch);
+    void wait_micro_batch(int pipeline, int micro_batch);
+
+    void set_fusion_bucket_size(size_t bytes);
+    void set_segment_size(size_t bytes);
+    void set_hierarchical_allreduce(bool enable);
+    void set_allreduce_algorithm(int algorithm);
+    void set_progress_thread(bool enable);
+    void set_compression(int request_id, int mode, float ratio);
+
+    MPI_Comm inter_net_comm() const { return *Inter_net_communicator; }
+
+  private:
+    static int requested_thread_level();
+    void sync_segments(float* data, int count, int request_id, int reduce_num);
+
+    std::vector<AllreduceRequest *> requests;
+    MPI_Comm *Inter_net_communicator;
+    MPI_Comm *Intra_net_communicator;
+    GradientFusion fusion;
+    GradientCompression compression;
+    // Allreduces of the segments of each gradient synced by sync_segments
+    std::vector<std::vector<AllreduceRequest> > segment_requests;
+    // Segment size in floats, 0 reduces and sends gradients whole
+    size_t segment_floats;
+    // Thread support MPI was initialized with
+    int thread_support;
+    // Micro-batch transfers run on their own communicator so that their
+    // tags cannot match those of send_intra and recv_intra
+    MPI_Comm pipeline_comm;
+    std::vector<MicroBatchPipeline> pipelines;
+};
+
+#endif
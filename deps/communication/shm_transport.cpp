@@ -0,0 +1,261 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+#include <new>
+
+#include "shm_transport.h"
+
+// Spins before a waiting rank yields its core
+#define SHM_SPINS 1024
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory barriers need lock-free atomics");
+
+static int env_int(const char* name, int default_value) {
+    const char* value = getenv(name);
+    return value == NULL ? default_value : atoi(value);
+}
+
+static size_t round_up(size_t bytes, size_t alignment) {
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+ShmTransport::ShmTransport() {
+    rank = env_int("LATTE_SHM_RANK", -1);
+    size = env_int("LATTE_SHM_SIZE", -1);
+    if (rank < 0 || size < 1 || rank >= size) {
+        std::cerr << "Error: the shm transport needs LATTE_SHM_RANK and LATTE_SHM_SIZE" << std::endl;
+        assert(false);
+    }
+    const char* id = getenv("LATTE_SHM_JOB");
+    if (id == NULL || *id == '\0' || strlen(id) >= SHM_JOB_LENGTH) {
+        std::cerr << "Error: the shm transport needs LATTE_SHM_JOB, an id of fewer than "
+                  << SHM_JOB_LENGTH << " characters unique to the job" << std::endl;
+        assert(false);
+    }
+    job = id;
+    const char* segment = getenv("LATTE_SHM_NAME");
+    name = segment == NULL ? "/latte_comm_" + job : segment;
+    num_requests = 0;
+    size_t chunk_floats = env_int("LATTE_SHM_CHUNK_SIZE", DEFAULT_SHM_CHUNK_SIZE) / sizeof(float);
+    assert(chunk_floats > 0);
+    size_t header = round_up(sizeof(ShmControl), 64);
+    mapped_bytes = header + (size + 1) * chunk_floats * sizeof(float);
+
+    if (rank == 0) {
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, mapped_bytes) != 0) {
+            std::cerr << "Error: could not create shared memory segment " << name << std::endl;
+            assert(false);
+        }
+        map(fd, chunk_floats);
+        new (&control->attached) std::atomic<int>(1);
+        new (&control->barrier_count) std::atomic<int>(0);
+        new (&control->barrier_generation) std::atomic<int>(0);
+        // job is shorter than SHM_JOB_LENGTH, see above
+        memcpy(control->job, job.c_str(), job.size() + 1);
+        control->size = size;
+        control->chunk_floats = chunk_floats;
+        new (&control->ready) std::atomic<int>(0);
+        control->ready.store(1, std::memory_order_release);
+        while (control->attached.load(std::memory_order_acquire) < size) usleep(1000);
+        // All ranks hold a mapping, the name is no longer needed
+        shm_unlink(name.c_str());
+    } else {
+        // Wait for rank 0 to create the segment of this job
+        while (!attach(chunk_floats)) usleep(1000);
+    }
+}
+
+void ShmTransport::map(int fd, size_t chunk_floats) {
+    void* base = mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(base != MAP_FAILED);
+    control = (ShmControl*) base;
+    staging_buffers = (float*) ((char*) base + round_up(sizeof(ShmControl), 64));
+    result = staging_buffers + size * chunk_floats;
+}
+
+// Attach to the segment under name if rank 0 of this job has set it up,
+// a segment not set up yet or of another job is let go
+bool ShmTransport::attach(size_t chunk_floats) {
+    struct stat st;
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) return false;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < mapped_bytes) {
+        close(fd);
+        return false;
+    }
+    map(fd, chunk_floats);
+    if (control->ready.load(std::memory_order_acquire) == 0 ||
+            strncmp(control->job, job.c_str(), SHM_JOB_LENGTH) != 0) {
+        munmap(control, mapped_bytes);
+        control = NULL;
+        return false;
+    }
+    if (control->size != size || control->chunk_floats != chunk_floats) {
+        std::cerr << "Error: LATTE_SHM_SIZE or LATTE_SHM_CHUNK_SIZE differ between ranks" << std::endl;
+        assert(false);
+    }
+    control->attached.fetch_add(1, std::memory_order_acq_rel);
+    return true;
+}
+
+ShmTransport::~ShmTransport() {
+    munmap(control, mapped_bytes);
+}
+
+void ShmTransport::barrier() {
+    int generation = control->barrier_generation.load(std::memory_order_acquire);
+    if (control->barrier_count.fetch_add(1, std::memory_order_acq_rel) == size - 1) {
+        control->barrier_count.store(0, std::memory_order_relaxed);
+        control->barrier_generation.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    int spins = 0;
+    while (control->barrier_generation.load(std::memory_order_acquire) == generation) {
+        if (++spins >= SHM_SPINS) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
+
+void ShmTransport::allreduce(float* data, int count) {
+    size_t chunk_floats = control->chunk_floats;
+    for (int offset = 0; offset < count; offset += chunk_floats) {
+        int n = std::min((int) chunk_floats, count - offset);
+        memcpy(staging(rank), data + offset, n * sizeof(float));
+        barrier();
+        // Each rank sums its share of the chunk, in rank order so that all
+        // ranks see the same rounding
+        int begin = (int) ((long) n * rank / size);
+        int end = (int) ((long) n * (rank + 1) / size);
+        float* first = staging(0);
+#pragma omp parallel for simd
+        for (int i = begin; i < end; i++) {
+            result[i] = first[i];
+        }
+        for (int r = 1; r < size; r++) {
+            float* other = staging(r);
+#pragma omp parallel for simd
+            for (int i = begin; i < end; i++) {
+                result[i] += other[i];
+            }
+        }
+        barrier();
+        memcpy(data + offset, result, n * sizeof(float));
+    }
+}
+
+int ShmTransport::get_rank() {
+    return rank;
+}
+
+int ShmTransport::get_size() {
+    return size;
+}
+
+int ShmTransport::get_inter_size() {
+    return size;
+}
+
+void ShmTransport::initialize_communicators(int num_subgroups) {
+    if (num_subgroups != 1) {
+        std::cerr << "Error: the shm transport does not support net subgroups, use MPI" << std::endl;
+        assert(false);
+    }
+}
+
+int ShmTransport::init_request() {
+    return num_requests++;
+}
+
+void ShmTransport::sync_gradients(float* data, int count, int request_id, int reduce_num) {
+    assert(request_id >= 0 && request_id < num_requests);
+    if (reduce_num > 1) {
+        reduce_threads(data, 0, count, count, reduce_num);
+    }
+    allreduce(data, count);
+}
+
+void ShmTransport::wait(int request_id) {
+    // Gradients are complete when sync_gradients returns
+    assert(request_id >= 0 && request_id < num_requests);
+}
+
+void ShmTransport::average_parameters(float* data, int count) {
+    allreduce(data, count);
+    float scale = 1.0f / size;
+#pragma omp parallel for simd
+    for (int i = 0; i < count; i++) {
+        data[i] *= scale;
+    }
+}
+
+float ShmTransport::reduce_accuracy(float acc) {
+    allreduce(&acc, 1);
+    return rank == 0 ? acc / size : -1.0f;
+}
+
+void ShmTransport::broadcast_inter(float* value, int length, int root) {
+    size_t chunk_floats = control->chunk_floats;
+    for (int offset = 0; offset < length; offset += chunk_floats) {
+        int n = std::min((int) chunk_floats, length - offset);
+        // Others may still be copying the result of a previous allreduce,
+        // the root's staging buffer is no longer read by then
+        if (rank == root) memcpy(staging(root), value + offset, n * sizeof(float));
+        barrier();
+        if (rank != root) memcpy(value + offset, staging(root), n * sizeof(float));
+        barrier();
+    }
+}
+
+void ShmTransport::broadcast_intra(float* value, int length, int root) {
+    // The intra-net group is this process alone
+    assert(root == 0);
+}
+
+void ShmTransport::recv_intra(float* data, int length, int tag, int source) {
+    std::cerr << "Error: the shm transport does not support net subgroups, use MPI" << std::endl;
+    assert(false);
+}
+
+void ShmTransport::send_intra(float* data, int length, int tag, int dest) {
+    std::cerr << "Error: the shm transport does not support net subgroups, use MPI" << std::endl;
+    assert(false);
+}
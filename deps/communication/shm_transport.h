@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_SHM_TRANSPORT_H
+#define LATTE_SHM_TRANSPORT_H
+
+#include <atomic>
+#include <string>
+
+#include "transport.h"
+
+// Default size of the per-rank staging buffers, in bytes
+#define DEFAULT_SHM_CHUNK_SIZE (4 << 20)
+// Longest job id told apart by the ranks attaching to a segment
+#define SHM_JOB_LENGTH 64
+
+// Head of the shared segment, followed by a staging buffer of chunk_floats
+// floats per rank and a result buffer of the same size
+struct ShmControl {
+    std::atomic<int> ready;
+    std::atomic<int> attached;
+    // LATTE_SHM_JOB of the rank 0 that created the segment
+    char job[SHM_JOB_LENGTH];
+    int size;
+    size_t chunk_floats;
+    std::atomic<int> barrier_count;
+    std::atomic<int> barrier_generation;
+};
+
+// Transport for processes on one host over a POSIX shared memory segment,
+// needs no MPI.  Processes are told their place by the environment:
+//
+//   LATTE_SHM_JOB         id shared by the processes of the job only, such
+//                         as the launcher's job id
+//   LATTE_SHM_RANK        rank of the process, from 0
+//   LATTE_SHM_SIZE        number of processes
+//   LATTE_SHM_NAME        segment name (/latte_comm_<job>)
+//   LATTE_SHM_CHUNK_SIZE  bytes staged per rank and step (4MB)
+//
+// Ranks only attach to a segment created for their job, a segment left
+// under the same name by another or a crashed job is waited out until rank
+// 0 replaces it.
+// Gradients are summed when sync_gradients is called: each rank copies a
+// chunk into its staging buffer, sums its share of the chunk over all
+// staging buffers into the result and copies the result back.  Every net
+// subgroup must be a single process, model parallel nets need MPI.
+class ShmTransport : public Transport {
+  public:
+    ShmTransport();
+    ~ShmTransport();
+
+    int get_rank();
+    int get_size();
+    int get_inter_size();
+    void initialize_communicators(int num_subgroups);
+
+    int init_request();
+    void sync_gradients(float* data, int count, int request_id, int reduce_num);
+    void wait(int request_id);
+    void average_parameters(float* data, int count);
+
+    float reduce_accuracy(float acc);
+    void broadcast_inter(float* value, int length, int root);
+    void broadcast_intra(float* value, int length, int root);
+    void recv_intra(float* data, int length, int tag, int source);
+    void send_intra(float* data, int length, int tag, int dest);
+
+  private:
+    void barrier();
+    void map(int fd, size_t chunk_floats);
+    bool attach(size_t chunk_floats);
+    void allreduce(float* data, int count);
+    float* staging(int r) { return staging_buffers + r * control->chunk_floats; }
+
+    int rank;
+    int size;
+    int num_requests;
+    std::string job;
+    std::string name;
+    size_t mapped_bytes;
+    ShmControl* control;
+    float* staging_buffers;
+    float* result;
+};
+
+#endif
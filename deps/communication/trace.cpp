@@ -0,0 +1,233 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <assert.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+#include "trace.h"
+
+// Wall clock, so that the traces of ranks on different hosts line up as
+// well as their clocks do
+static double now() {
+    return std::chrono::duration_cast<std::chrono::duration<double, std::micro> >(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+CommTrace::CommTrace() {
+    enabled = false;
+    head = 0;
+    capacity = DEFAULT_TRACE_CAPACITY;
+    dropped = 0;
+}
+
+void CommTrace::set_enabled(bool enable) {
+    enabled = enable;
+    in_flight.clear();
+}
+
+double CommTrace::begin() const {
+    return enabled ? now() : 0.0;
+}
+
+void CommTrace::call(const char* name, double start, int request, size_t bytes, int peer) {
+    if (!enabled) return;
+    TraceEvent event;
+    event.name = name;
+    event.start = start;
+    event.duration = now() - start;
+    event.request = request;
+    event.bytes = bytes;
+    event.peer = peer;
+    event.flight = false;
+    record(event);
+}
+
+void CommTrace::record(const TraceEvent& event) {
+    if (events.size() < capacity) {
+        events.push_back(event);
+        return;
+    }
+    events[head] = event;
+    head = (head + 1) % capacity;
+    dropped++;
+}
+
+const TraceEvent& CommTrace::last() const {
+    return events.size() < capacity ? events.back() : events[(head + capacity - 1) % capacity];
+}
+
+std::vector<TraceEvent> CommTrace::ordered() const {
+    std::vector<TraceEvent> result(events.begin() + head, events.end());
+    result.insert(result.end(), events.begin(), events.begin() + head);
+    return result;
+}
+
+void CommTrace::issue(int request, size_t bytes, double start) {
+    if (!enabled) return;
+    call("sync_gradients", start, request, bytes, -1);
+    TraceEvent flight = last();
+    flight.name = "allreduce";
+    flight.flight = true;
+    in_flight[request] = flight;
+}
+
+void CommTrace::complete(int request, double start) {
+    if (!enabled) return;
+    std::map<int, TraceEvent>::iterator it = in_flight.find(request);
+    size_t bytes = it == in_flight.end() ? 0 : it->second.bytes;
+    call("wait", start, request, bytes, -1);
+    // The first wait of a parameter has no gradient in flight
+    if (it == in_flight.end()) return;
+    TraceEvent flight = it->second;
+    flight.duration = last().start + last().duration - flight.start;
+    record(flight);
+    in_flight.erase(it);
+}
+
+void CommTrace::clear() {
+    events.clear();
+    head = 0;
+    dropped = 0;
+    in_flight.clear();
+}
+
+// Keeps the latest num_events events recorded so far
+void CommTrace::set_capacity(size_t num_events) {
+    assert(num_events > 0);
+    std::vector<TraceEvent> kept = ordered();
+    if (kept.size() > num_events) {
+        dropped += kept.size() - num_events;
+        kept.erase(kept.begin(), kept.end() - num_events);
+    }
+    events.swap(kept);
+    head = 0;
+    capacity = num_events;
+}
+
+// Totals of the events of one gradient or one call
+struct TraceTotals {
+    int count;
+    double bytes;
+    double time;
+    double max_time;
+    double flight_time;
+    double blocked_time;
+
+    TraceTotals() : count(0), bytes(0), time(0), max_time(0), flight_time(0), blocked_time(0) { }
+};
+
+static bool more_blocked(const std::pair<int, TraceTotals>& a, const std::pair<int, TraceTotals>& b) {
+    return a.second.blocked_time > b.second.blocked_time;
+}
+
+void CommTrace::dump(const char* prefix, int rank) const {
+    std::vector<TraceEvent> events = ordered();
+    std::string base = std::string(prefix) + "." + std::to_string(rank);
+    FILE* file = fopen((base + ".json").c_str(), "w");
+    if (file == NULL) {
+        std::cerr << "Error: could not write " << base << ".json" << std::endl;
+        return;
+    }
+    fprintf(file, "{\"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, "
+                  "\"args\": {\"name\": \"comm calls\"}}", rank);
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+        fprintf(file, ",\n");
+        if (event.flight) {
+            // Flights overlap, async events keep them apart
+            const char* phases[] = {"b", "e"};
+            for (int p = 0; p < 2; p++) {
+                fprintf(file, "%s{\"name\": \"allreduce %d\", \"cat\": \"gradient\", \"ph\": \"%s\", "
+                              "\"id\": %d, \"ts\": %.3f, \"pid\": %d, \"tid\": 1, "
+                              "\"args\": {\"request\": %d, \"bytes\": %zu}}",
+                        p == 0 ? "" : ",\n", event.request, phases[p], event.request,
+                        event.start + p * event.duration, rank, event.request, event.bytes);
+            }
+        } else {
+            fprintf(file, "{\"name\": \"%s\", \"cat\": \"call\", \"ph\": \"X\", \"ts\": %.3f, "
+                          "\"dur\": %.3f, \"pid\": %d, \"tid\": 0, "
+                          "\"args\": {\"request\": %d, \"bytes\": %zu, \"peer\": %d}}",
+                    event.name, event.start, event.duration, rank, event.request,
+                    event.bytes, event.peer);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    std::map<int, TraceTotals> gradients;
+    std::map<std::string, TraceTotals> calls;
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+        if (event.flight) {
+            TraceTotals& totals = gradients[event.request];
+            totals.count++;
+            totals.bytes += event.bytes;
+            totals.flight_time += event.duration;
+            continue;
+        }
+        TraceTotals& totals = calls[event.name];
+        totals.count++;
+        totals.bytes += event.bytes;
+        totals.time += event.duration;
+        totals.max_time = std::max(totals.max_time, event.duration);
+        if (event.request >= 0 && std::string(event.name) == "wait") {
+            gradients[event.request].blocked_time += event.duration;
+        } else if (event.request >= 0) {
+            gradients[event.request].time += event.duration;
+        }
+    }
+    file = fopen((base + ".txt").c_str(), "w");
+    if (file == NULL) {
+        std::cerr << "Error: could not write " << base << ".txt" << std::endl;
+        return;
+    }
+    if (dropped > 0) {
+        fprintf(file, "%zu older events were dropped, see set_comm_trace_capacity\n\n", dropped);
+    }
+    // Gradients waited for longest are on the critical path
+    std::vector<std::pair<int, TraceTotals> > by_blocked(gradients.begin(), gradients.end());
+    std::sort(by_blocked.begin(), by_blocked.end(), more_blocked);
+    fprintf(file, "%8s %6s %12s %12s %12s %12s\n",
+            "request", "syncs", "bytes", "sync ms", "flight ms", "blocked ms");
+    for (size_t i = 0; i < by_blocked.size(); i++) {
+        const TraceTotals& totals = by_blocked[i].second;
+        fprintf(file, "%8d %6d %12.0f %12.3f %12.3f %12.3f\n", by_blocked[i].first, totals.count,
+                totals.count > 0 ? totals.bytes / totals.count : 0.0, totals.time / 1e3,
+                totals.flight_time / 1e3, totals.blocked_time / 1e3);
+    }
+    fprintf(file, "\n%-20s %8s %14s %12s %12s\n", "call", "count", "bytes", "total ms", "max ms");
+    for (std::map<std::string, TraceTotals>::const_iterator it = calls.begin(); it != calls.end(); ++it) {
+        fprintf(file, "%-20s %8d %14.0f %12.3f %12.3f\n", it->first.c_str(), it->second.count,
+                it->second.bytes, it->second.time / 1e3, it->second.max_time / 1e3);
+    }
+    fclose(file);
+}
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_TRACE_H
+#define LATTE_TRACE_H
+
+#include <stddef.h>
+#include <map>
+#include <vector>
+
+// A call into the comm library, or the flight of a gradient from
+// sync_gradients to the end of its wait
+struct TraceEvent {
+    const char* name;
+    double start;          // us since the epoch
+    double duration;       // us
+    int request;           // gradient request, -1 if none
+    size_t bytes;
+    int peer;              // root, source or destination, -1 if none
+    bool flight;
+};
+
+// Events kept unless set_capacity is called, about 50MB
+#define DEFAULT_TRACE_CAPACITY (1 << 20)
+
+// Records the comm library's calls.  Written per rank as a Chrome trace
+// (chrome://tracing, Perfetto) and a summary of the time spent per
+// gradient and per call.  Only the latest capacity events are kept, older
+// ones are overwritten.
+class CommTrace {
+  public:
+    CommTrace();
+
+    void set_enabled(bool enable);
+    // Start time of a call, 0 when tracing is off
+    double begin() const;
+    void call(const char* name, double start, int request, size_t bytes, int peer);
+    // sync_gradients of request returned, its flight started at start
+    void issue(int request, size_t bytes, double start);
+    // wait of request returned
+    void complete(int request, double start);
+    void dump(const char* prefix, int rank) const;
+    void clear();
+    void set_capacity(size_t num_events);
+
+  private:
+    void record(const TraceEvent& event);
+    const TraceEvent& last() const;
+    // The events kept, oldest first
+    std::vector<TraceEvent> ordered() const;
+
+    bool enabled;
+    // Ring of events, events[head] is the oldest once it is full
+    std::vector<TraceEvent> events;
+    size_t head;
+    size_t capacity;
+    // Events overwritten since the last clear
+    size_t dropped;
+    // Gradients issued but not waited for, their issue event
+    std::map<int, TraceEvent> in_flight;
+};
+
+#endif
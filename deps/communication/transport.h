@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATTE_TRANSPORT_H
+#define LATTE_TRANSPORT_H
+
+#include <stddef.h>
+
+// Carries the communication behind the comm library's C API.  Ranks number
+// all processes from 0.  After initialize_communicators, the inter-net group
+// of a rank holds the replicas of its net subgroup and the intra-net group
+// the subgroups of its replica.
+class Transport {
+  public:
+    virtual ~Transport() { }
+
+    virtual int get_rank() = 0;
+    virtual int get_size() = 0;
+    // Number of ranks in the inter-net group
+    virtual int get_inter_size() = 0;
+    virtual void initialize_communicators(int num_subgroups) = 0;
+
+    // Gradients are summed over the inter-net group.  sync_gradients starts
+    // the sum of the first count floats at data after adding the other
+    // reduce_num - 1 thread copies to them, wait completes it.
+    virtual int init_request() = 0;
+    virtual void sync_gradients(float* data, int count, int request_id, int reduce_num) = 0;
+    virtual void wait(int request_id) = 0;
+    virtual void flush_gradients() { }
+    // Replaces the first count floats at data with their mean over the
+    // inter-net group, for local SGD which averages parameters every few
+    // steps instead of summing every gradient
+    virtual void average_parameters(float* data, int count) = 0;
+
+    virtual float reduce_accuracy(float acc) = 0;
+    virtual void broadcast_inter(float* value, int length, int root) = 0;
+    virtual void broadcast_intra(float* value, int length, int root) = 0;
+    virtual void recv_intra(float* data, int length, int tag, int source) = 0;
+    virtual void send_intra(float* data, int length, int tag, int dest) = 0;
+
+    // Non-blocking transfer of a batch of batch_size items of item_length
+    // floats to or from a neighbouring subgroup, split into micro-batches of
+    // consecutive items.  At most two micro-batches of a pipeline are in
+    // flight, starting a third waits for the oldest one.
+    virtual int open_pipeline(float* data, int item_length, int batch_size,
+                              int num_micro_batches, int tag, int peer, bool send);
+    virtual void start_micro_batch(int pipeline, int micro_batch);
+    virtual void wait_micro_batch(int pipeline, int micro_batch);
+
+    // Tuning of the gradient exchange, ignored with a warning by transports
+    // without it
+    virtual void set_fusion_bucket_size(size_t bytes);
+    virtual void set_segment_size(size_t bytes);
+    virtual void set_hierarchical_allreduce(bool enable);
+    virtual void set_allreduce_algorithm(int algorithm);
+    virtual void set_progress_thread(bool enable);
+    virtual void set_compression(int request_id, int mode, float ratio);
+};
+
+// Sum the reduce_num thread copies of gradient elements [begin, end) into
+// the first copy
+void reduce_threads(float* data, int begin, int end, int count, int reduce_num);
+
+#endif
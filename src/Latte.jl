@@ -52,14 +52,21 @@ if haskey(ENV, "LATTE_BATCH_DROPOUT")
     LATTE_BATCH_DROPOUT = true
 end
 
-LATTE_MPI = false
-if haskey(ENV, "LATTE_MPI")
-    LATTE_MPI = true
-
+# LATTE_COMM enables the calls to the comm library: over MPI when LATTE_MPI
+# is set, or over shared memory with LATTE_TRANSPORT=shm, which needs no
+# MPI.  LATTE_MPI is only kept with the MPI transport, the data layers then
+# read their files through MPI-IO.  Either way datasets are split over the
+# ranks of the transport.
+LATTE_COMM = haskey(ENV, "LATTE_MPI") || get(ENV, "LATTE_TRANSPORT", "") == "shm"
+LATTE_MPI = haskey(ENV, "LATTE_MPI") && get(ENV, "LATTE_TRANSPORT", "mpi") == "mpi"
+latte_rank, latte_size = 0, 1
+if LATTE_COMM
     @eval ccall((:init, $libComm), Void, ())
+    latte_rank = @eval ccall((:get_rank, $libComm), Cint, ())
+    latte_size = @eval ccall((:get_size, $libComm), Cint, ())
     log_info("Finished initializing comm library")
 end
-@eval ccall((:init, $libIO), Void, (Cuchar,), LATTE_MPI)
+@eval ccall((:init, $libIO), Void, (Cuchar, Cint, Cint), LATTE_MPI, latte_rank, latte_size)
 atexit(() -> @eval ccall((:clean_up, $libIO), Void, ()))
 
 @enum Phase TrainTest Train Test
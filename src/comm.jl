@@ -71,3 +71,171 @@ end
     ccall((:broadcast_intra, $libComm), Void, (Ptr{Float32}, Cint, Cint), epoch, 1, 0)
     net.test_epoch = epoch[1]
 end
+
+"""
+Start reducing the gradients still packed in a partially filled bucket.
+Called after `backward` so the last bucket overlaps the following work.
+"""
+@eval function flush_gradients(net::Net)
+    ccall((:flush_gradients, $libComm), Void, ())
+end
+
+"""
+Let every rank step on its own gradients: `sync_gradients` only sums the
+thread copies of a gradient and multiplies it by the number of replicas,
+as if all replicas had computed the same gradient, so learning rates tuned
+for synchronous training still apply.  The replicas drift apart until their
+parameters are averaged by `average_params`.
+"""
+@eval function set_local_sgd(enable::Bool)
+    ccall((:set_local_sgd, $libComm), Void, (Cuchar,), enable)
+end
+
+# What becomes of the momentum history when parameters are averaged
+const MOMENTUM_CORRECTIONS = [:average, :reset, :keep]
+
+"""
+Replace the parameters of `net` with their mean over its replicas.  With
+`momentum = :average` the momentum history is averaged too, `:reset` zeroes
+it and `:keep` leaves every rank its own.
+"""
+@eval function average_params(net::Net; momentum=:average)
+    @assert(momentum in MOMENTUM_CORRECTIONS, "Unknown momentum correction $momentum")
+    for param in net.params
+        ccall((:average_parameters, $libComm), Void, (Ptr{Float32}, Cint),
+              param.value, length(param.value))
+        if momentum == :average
+            ccall((:average_parameters, $libComm), Void, (Ptr{Float32}, Cint),
+                  param.hist, length(param.hist))
+        elseif momentum == :reset
+            fill!(param.hist, 0.0f0)
+        end
+    end
+end
+
+"""
+Gradients smaller than `bytes` are packed together and reduced by one
+allreduce per bucket, 0 (the default) reduces every gradient on its own.
+4MB buckets are a good start when small gradients dominate.
+"""
+@eval function set_fusion_bucket_size(bytes::Integer)
+    ccall((:set_fusion_bucket_size, $libComm), Void, (Csize_t,), bytes)
+end
+
+"""
+Gradients larger than `bytes` are summed over threads a segment of `bytes`
+at a time, each segment being sent while the next one is summed.  0 sums and
+sends gradients whole.
+"""
+@eval function set_segment_size(bytes::Integer)
+    ccall((:set_segment_size, $libComm), Void, (Csize_t,), bytes)
+end
+
+# Order of CompressionMode in deps/communication/compression.h
+const COMPRESSION_MODES = [:none, :fp16, :topk]
+
+"""
+Exchange the gradient of `param` compressed with `mode`: `:fp16` sends half
+floats, `:topk` sends the fraction `ratio` of entries largest in magnitude
+and carries the others over to the next iteration.
+"""
+@eval function set_compression(param::Param, mode::Symbol; ratio=0.01f0)
+    id = findfirst(COMPRESSION_MODES, mode)
+    @assert(id > 0, "Unknown gradient compression $mode")
+    ccall((:set_compression, $libComm), Void, (Cint, Cint, Cfloat), param.request, id - 1, ratio)
+end
+
+"""
+Compress the gradients of the parameters of `net` with at least `min_length`
+entries, smaller ones stay exact.
+"""
+function set_compression(net::Net, mode::Symbol; ratio=0.01f0, min_length=65536)
+    for param in net.params
+        if length(param.value) >= min_length
+            set_compression(param, mode; ratio=ratio)
+        end
+    end
+end
+
+"""
+Reduce gradients among the ranks of each node first, then among one rank
+per node, and broadcast the result within each node.  Must be set the same
+way on every rank.
+"""
+@eval function set_hierarchical_allreduce(enable::Bool)
+    ccall((:set_hierarchical_allreduce, $libComm), Void, (Cuchar,), enable)
+end
+
+# Order of AllreduceAlgorithm in deps/communication/allreduce.h
+const ALLREDUCE_ALGORITHMS = [:mpi, :ring]
+
+"""
+Sum gradients with MPI's allreduce (`:mpi`) or with the library's ring
+allreduce (`:ring`).  Must be set the same way on every rank.
+"""
+@eval function set_allreduce_algorithm(algorithm::Symbol)
+    id = findfirst(ALLREDUCE_ALGORITHMS, algorithm)
+    @assert(id > 0, "Unknown allreduce algorithm $algorithm")
+    ccall((:set_allreduce_algorithm, $libComm), Void, (Cint,), id - 1)
+end
+
+"""
+Drive the gradient reductions in flight from a background thread while
+backward runs, instead of only when their parameter is waited for.  MPI
+must be thread safe, which is requested by setting LATTE_MPI_THREADS=multiple.
+"""
+@eval function set_progress_thread(enable::Bool)
+    ccall((:set_progress_thread, $libComm), Void, (Cuchar,), enable)
+end
+
+"""
+Transfer `buffer`, a batch of `net.batch_size` items, to (`send`) or from
+the net subgroup `peer` in `micro_batches` parts.  Returns a pipeline whose
+parts are started with `start_micro_batch` and completed with
+`wait_micro_batch`, so a stage can compute part `i + 1` while part `i` is in
+flight.  Pipelines are opened once and reused every iteration.
+"""
+@eval function open_pipeline(net::Net, buffer::Array{Float32}, tag::Integer,
+                             peer::Integer, send::Bool; micro_batches=4)
+    item_length = div(length(buffer), net.batch_size)
+    ccall((:open_pipeline, $libComm), Cint,
+          (Ptr{Float32}, Cint, Cint, Cint, Cint, Cint, Cuchar),
+          buffer, item_length, net.batch_size, micro_batches, tag, peer, send)
+end
+
+@eval function start_micro_batch(pipeline::Integer, micro_batch::Integer)
+    ccall((:start_micro_batch, $libComm), Void, (Cint, Cint), pipeline, micro_batch - 1)
+end
+
+@eval function wait_micro_batch(pipeline::Integer, micro_batch::Integer)
+    ccall((:wait_micro_batch, $libComm), Void, (Cint, Cint), pipeline, micro_batch - 1)
+end
+
+"""
+Record every call into the comm library, from now on or until disabled.
+Setting LATTE_COMM_TRACE=<prefix> traces the whole run and dumps it at exit.
+"""
+@eval function set_comm_trace(enable::Bool)
+    ccall((:set_comm_trace, $libComm), Void, (Cuchar,), enable)
+end
+
+"""
+Write the calls recorded on this rank to `<prefix>.<rank>.json`, a Chrome
+trace, and a summary of the time spent per gradient and per call, longest
+blocked gradients first, to `<prefix>.<rank>.txt`.
+"""
+@eval function dump_comm_trace(prefix::AbstractString)
+    ccall((:dump_comm_trace, $libComm), Void, (Ptr{UInt8},), prefix)
+end
+
+@eval function clear_comm_trace()
+    ccall((:clear_comm_trace, $libComm), Void, ())
+end
+
+"""
+Keep only the latest `num_events` calls and gradient flights (2^20 by
+default, about 50MB), older ones are dropped from the dumped trace.
+"""
+@eval function set_comm_trace_capacity(num_events::Integer)
+    ccall((:set_comm_trace_capacity, $libComm), Void, (Csize_t,), num_events)
+end
@@ -120,7 +120,7 @@ function init_params(ensemble::AbstractEnsemble, net::Net)
             param.gradient = get_buffer(net, param.gradient_name)
             param.hist = zeros(param.value)
             set_buffer(net, param.hist_name, param.hist)
-            @latte_mpi param.request = @eval ccall((:init_request, $libComm), Cint, ())
+            @latte_comm param.request = @eval ccall((:init_request, $libComm), Cint, ())
         end
     end
 end
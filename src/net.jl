@@ -388,7 +388,7 @@ function generate_c_function(func::Function, signature::Tuple,
         end
     end
     s = ""
-    @latte_mpi(s *= "#include \"comm.h\"\n")
+    @latte_comm(s *= "#include \"comm.h\"\n")
     s *= CGen.from_root_entry(ast, function_name_string)
     proxy_name = string("_", function_name_string, "_j2c_proxy")
     proxy_sym = symbol(proxy_name)
@@ -400,13 +400,13 @@ function generate_c_function(func::Function, signature::Tuple,
     outfile_name = CGen.writec(s)
     cflags = []
     # push!(cflags, "-qopt-report")
-    @latte_mpi push!(cflags, "-I$latte_library_path/communication")
+    @latte_comm push!(cflags, "-I$latte_library_path/communication")
     @latte_mpi ENV["CGEN_COMPILER"] = "mpiicpc"
     CGen.compile(outfile_name; flags=cflags)
 
     lflags = []
-    @latte_mpi push!(lflags, "-L$latte_library_path")
-    @latte_mpi push!(lflags, "-lLatteComm")
+    @latte_comm push!(lflags, "-L$latte_library_path")
+    @latte_comm push!(lflags, "-lLatteComm")
     dyn_lib = CGen.link(outfile_name; flags=lflags)
 
     proxy_params = [:($arg::$typ) for (arg, typ) in zip(args, signature)]
@@ -766,7 +766,7 @@ function init(net::Net)
         push!(seen_names, ensemble.name)
 
         # If in MPI mode skip ensembles not assigned to this subrank
-        @latte_mpi(if ensemble.net_subgroup != get_net_subrank(net) + 1
+        @latte_comm(if ensemble.net_subgroup != get_net_subrank(net) + 1
             continue  # skip
         end)
         net.ensemble_send_list[ensemble.name] = Tuple{Int, Int}[]
@@ -781,7 +781,7 @@ function init(net::Net)
     for (index, ensemble) in enumerate(net.ensembles)
         # If in MPI mode, populate the send_list for connected ensembles not in
         # this subrank and skip initializations
-        @latte_mpi if ensemble.net_subgroup != get_net_subrank(net) + 1
+        @latte_comm if ensemble.net_subgroup != get_net_subrank(net) + 1
             for connection in ensemble.connections
                 if connection.source.net_subgroup == get_net_subrank(net) + 1
                     push!(net.ensemble_send_list[connection.source.name], 
@@ -800,11 +800,11 @@ function init(net::Net)
     log_info("  Synthesizing forward functions.")
     # Generate forward tasks
     for ensemble in net.ensembles
-        @latte_mpi if ensemble.net_subgroup != get_net_subrank(net) + 1
+        @latte_comm if ensemble.net_subgroup != get_net_subrank(net) + 1
             continue  # skip
         end
 
-        @latte_mpi for connection in ensemble.connections
+        @latte_comm for connection in ensemble.connections
             if connection.source.net_subgroup != ensemble.net_subgroup
                 add_recv_expr(net, connection.source, ensemble,
                               forward_compute_body, forward_compute_args)
@@ -824,7 +824,7 @@ function init(net::Net)
             throw("Latte Error: Encountered unsupported ensemble type $(typeof(ensemble)).")
         end
 
-        @latte_mpi add_send_exprs(net, ensemble, forward_compute_body,
+        @latte_comm add_send_exprs(net, ensemble, forward_compute_body,
                                   forward_compute_args)
     end
     append!(net.forward_tasks, forward_data_tasks)
@@ -836,7 +836,7 @@ function init(net::Net)
     log_info("  Synthesizing backward functions.")
     # Backward tasks
     for ensemble in net.ensembles
-        @latte_mpi (if ensemble.net_subgroup != get_net_subrank(net) + 1
+        @latte_comm (if ensemble.net_subgroup != get_net_subrank(net) + 1
             continue
         end)
         if typeof(ensemble) <: DataEnsemble || ensemble.phase == Test
@@ -863,7 +863,7 @@ function init(net::Net)
             # throw("NotImplementedError")
         elseif isa(ensemble, Union{Ensemble, ActivationEnsemble})
             for param in ensemble.params
-                @latte_mpi(begin
+                @latte_comm(begin
                     if LOSSY_GRADIENTS
                         gradient_length = length(param.gradient)
                         reduce_num = -1
@@ -1043,7 +1043,7 @@ function test(net::Net)
             accuracy += get_buffer(net, :accuracyvalue)[1]
         end
         clear_values(net)
-        @latte_mpi sync_intra_test_epoch(net)
+        @latte_comm sync_intra_test_epoch(net)
     end
     accuracy / num_batches * 100.0f0
 end
@@ -1085,7 +1085,7 @@ Get the current loss for `net`
 TODO: This is not general, assumes one :loss ensemble
 """
 function get_loss(net::Net)
-    @latte_mpi(if haskey(net.buffers[net.curr_buffer_set][1], :lossvalue)
+    @latte_comm(if haskey(net.buffers[net.curr_buffer_set][1], :lossvalue)
         loss = get_buffer(net, :lossvalue)[1]
         sync_intra_loss(net, loss)
         return loss
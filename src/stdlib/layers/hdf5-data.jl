@@ -39,6 +39,25 @@ type HDF5DataEnsemble <: DataEnsemble
     phase        :: Phase
 end
 
+# Options of one dataset, laid out like DatasetOptions in deps/IO/dataset.h
+immutable DatasetOptions
+    memory_budget  :: Csize_t
+    window_slabs   :: Cint
+    collective_io  :: Bool
+    max_open_files :: Cint
+    # Datasets much larger than memory_budget can be streamed with a global
+    # shuffle instead of being read a window of slabs at a time
+    streaming      :: Bool
+    read_ahead     :: Cint
+    # Train and test windows take turns in the same memory, each switch
+    # between them rereads a window
+    share_buffers  :: Bool
+    # Windows are interleaved over NUMA nodes, or copied to every node
+    numa_replicas  :: Bool
+    # 0 seeds the shuffles from the clock
+    seed           :: Cuint
+end
+
 function HDF5DataEnsemble(name::Symbol, neurons::Array{DataNeuron}, train_id::Cint, test_id::Cint)
     HDF5DataEnsemble(name, neurons, train_id, test_id, 1, 1, 1, Connection[], TrainTest)
 end
@@ -92,20 +111,100 @@ end
     end
 end
 
+# A source listing a single file names the HDF5 file to read, a source
+# listing several files is a manifest of shards read as one dataset
 function parse_hdf5_source(source::AbstractString)
-    open(source, "r") do s
-        strip(readlines(s)[1])
+    lines = open(source, "r") do s
+        filter(l -> !isempty(l), map(strip, readlines(s)))
     end
+    length(lines) == 1 ? split(lines[1])[1] : source
 end
 
 @eval function HDF5DataLayer(net::Net, train_data_source::AbstractString,
                        test_data_source::AbstractString;
-                       shuffle=true, scale=1.0f0)
+                       shuffle=true, scale=1.0f0, prefetch=false,
+                       memory_budget=2000000000, window_slabs=1,
+                       mean_file="", crop=(0, 0), mirror=false, collective_io=false,
+                       max_open_files=64, streaming=false, read_ahead=2,
+                       share_buffers=false, numa_replicas=false, seed=0)
     batch_size = net.batch_size
     @assert(batch_size > 0, "Data Layer batch_size must be greater than 0")
     train_data_source = parse_hdf5_source(train_data_source)
     test_data_source = parse_hdf5_source(test_data_source)
-    train_id = ccall((:init_dataset, $libIO), Cint, (Cint, Ptr{UInt8}, Cuchar, Cuchar, Cuchar), batch_size, train_data_source, shuffle, LATTE_MPI, false)
-    test_id = ccall((:init_dataset, $libIO), Cint, (Cint, Ptr{UInt8}, Cuchar, Cuchar, Cuchar), batch_size, test_data_source, false, LATTE_MPI, true)
+    # Only the training set is reshuffled across ranks
+    train_options = DatasetOptions(memory_budget, window_slabs, collective_io, max_open_files,
+                                   streaming, read_ahead, share_buffers, numa_replicas, seed)
+    test_options = DatasetOptions(memory_budget, window_slabs, false, max_open_files,
+                                  streaming, read_ahead, share_buffers, numa_replicas, seed)
+    train_id = ccall((:init_dataset_with_options, $libIO), Cint,
+                     (Cint, Ptr{UInt8}, Cuchar, Cuchar, Cuchar, Ref{DatasetOptions}),
+                     batch_size, train_data_source, shuffle, LATTE_MPI, false, train_options)
+    test_id = ccall((:init_dataset_with_options, $libIO), Cint,
+                    (Cint, Ptr{UInt8}, Cuchar, Cuchar, Cuchar, Ref{DatasetOptions}),
+                    batch_size, test_data_source, false, LATTE_MPI, true, test_options)
+    if mean_file != "" || crop != (0, 0) || mirror || scale != 1.0f0
+        # Training items are randomly cropped and mirrored, test items are
+        # center cropped
+        ccall((:set_transform, $libIO), Void, (Cint, Ptr{UInt8}, Cfloat, Cint, Cint, Cuchar, Cuchar),
+              train_id, mean_file, scale, crop[1], crop[2], true, mirror)
+        ccall((:set_transform, $libIO), Void, (Cint, Ptr{UInt8}, Cfloat, Cint, Cint, Cuchar, Cuchar),
+              test_id, mean_file, scale, crop[1], crop[2], false, false)
+    end
+    if prefetch
+        ccall((:set_prefetch, $libIO), Void, (Cint, Cuchar), train_id, true)
+        ccall((:set_prefetch, $libIO), Void, (Cint, Cuchar), test_id, true)
+    end
     HDF5DataEnsemble(net, train_id, test_id, :data), HDF5DataEnsemble(net, train_id, test_id, :label)
 end
+
+export io_stats, reset_io_stats
+
+# Order of IOCounter and IOTimer in deps/IO/io_stats.h
+const IO_COUNTERS = [:bytes_read, :items_read, :reads, :batches,
+                     :read_time, :gather_time, :stall_time, :shuffle_time]
+const IO_TIMERS = [:read, :gather, :stall, :shuffle]
+
+"""
+IO counters and latency histograms of the dataset read by `ens` in `phase`.
+Times are in seconds.  Entry 1 of a histogram counts events shorter than 1us
+and entry `i > 1` those in [2^(i-2), 2^(i-1)) us.
+"""
+@eval function io_stats(ens::HDF5DataEnsemble, phase::Phase=Train)
+    id = phase == Train ? ens.train_id : ens.test_id
+    stats = Dict{Symbol,Any}()
+    for (i, name) in enumerate(IO_COUNTERS)
+        stats[name] = ccall((:get_io_counter, $libIO), Cdouble, (Cint, Cint), id, i - 1)
+    end
+    num_buckets = ccall((:get_io_histogram_buckets, $libIO), Cint, ())
+    for (i, name) in enumerate(IO_TIMERS)
+        counts = zeros(Culong, num_buckets)
+        ccall((:get_io_histogram, $libIO), Void, (Cint, Cint, Ptr{Culong}), id, i - 1, counts)
+        stats[symbol(name, :_histogram)] = counts
+    end
+    stats
+end
+
+@eval function reset_io_stats(ens::HDF5DataEnsemble, phase::Phase=Train)
+    id = phase == Train ? ens.train_id : ens.test_id
+    ccall((:reset_io_stats, $libIO), Void, (Cint,), id)
+end
+
+export save_dataset_state, restore_dataset_state
+
+"""
+Save the position of the dataset read by `ens` in `phase`, its permutations
+and random state.  A dataset opened the same way and restored from it
+continues at the next batch, only reading the window it resumes in.
+"""
+@eval function save_dataset_state(ens::HDF5DataEnsemble, phase::Phase=Train)
+    id = phase == Train ? ens.train_id : ens.test_id
+    size = ccall((:save_state, $libIO), Cint, (Cint, Ptr{UInt8}, Cint), id, C_NULL, 0)
+    state = Array(UInt8, size)
+    ccall((:save_state, $libIO), Cint, (Cint, Ptr{UInt8}, Cint), id, state, size)
+    state
+end
+
+@eval function restore_dataset_state(ens::HDF5DataEnsemble, state::Vector{UInt8}, phase::Phase=Train)
+    id = phase == Train ? ens.train_id : ens.test_id
+    ccall((:restore_state, $libIO), Void, (Cint, Ptr{UInt8}, Cint), id, state, length(state))
+end
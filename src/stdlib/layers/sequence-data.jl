@@ -0,0 +1,129 @@
+#=
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+=#
+
+export SequenceDataLayer
+
+# Variable length sequences read from a packed HDF5 file (see
+# deps/IO/sequence_dataset.h).  `value` holds the current batch as
+# (item..., batch_size, time_steps) with zeros past the end of every
+# sequence, per sequence labels are (item..., batch_size).
+type SequenceDataEnsemble{N,M} <: DataEnsemble
+    name             :: Symbol
+    neurons          :: Array{DataNeuron,N}
+    value            :: Array{Float32,M}
+    train_id         :: Cint
+    test_id          :: Cint
+    per_step         :: Bool
+    # Number of steps of the longest sequence of the current batch
+    batch_time_steps :: Int
+    connections      :: Vector{Connection}
+    phase            :: Phase
+    net_subgroup     :: Cint
+end
+
+function SequenceDataEnsemble{N,M}(name::Symbol, neurons::Array{DataNeuron,N}, value::Array{Float32,M},
+                                   train_id::Cint, test_id::Cint, per_step::Bool)
+    SequenceDataEnsemble{N,M}(name, neurons, value, train_id, test_id, per_step, 0,
+                              Connection[], TrainTest, convert(Cint, 1))
+end
+
+@eval function forward{N}(ens::SequenceDataEnsemble, data::Array{Float32,N}, net::Net, phase::Phase)
+    id = phase == Train ? ens.train_id : ens.test_id
+    if net.curr_time_step == 1
+        if ens.name == :data
+            ccall((:get_next_sequence_batch, $libIO), Void, (Cint,), id)
+        end
+        epoch = ccall((:get_sequence_epoch, $libIO), Cint, (Cint,), id)
+        if phase == Train
+            net.train_epoch = epoch
+        else
+            net.test_epoch = epoch
+        end
+        ens.batch_time_steps = ccall((:get_sequence_batch_steps, $libIO), Cint, (Cint,), id)
+    end
+    if ens.per_step
+        data[:] = ens.value[[Colon() for _ in 1:ndims(ens)]..., :, net.curr_time_step]
+    else
+        data[:] = ens.value[:]
+    end
+end
+
+function backward{N}(ens::SequenceDataEnsemble, data::Array{Float32,N}, net::Net, phase::Phase)
+end
+
+@eval function SequenceDataEnsemble(net::Net, train_id::Cint, test_id::Cint, target::Symbol)
+    if target == :data
+        ndim = ccall((:get_sequence_data_ndim, $libIO), Cint, (Cint,), train_id)
+        _shape = ccall((:get_sequence_data_shape, $libIO), Ptr{Cint}, (Cint,), train_id)
+        per_step = true
+    else
+        ndim = ccall((:get_sequence_label_ndim, $libIO), Cint, (Cint,), train_id)
+        _shape = ccall((:get_sequence_label_shape, $libIO), Ptr{Cint}, (Cint,), train_id)
+        per_step = ccall((:get_sequence_label_per_step, $libIO), Bool, (Cint,), train_id)
+    end
+    # first index is the step (or sequence) so skip, reverse c order
+    shape = pointer_to_array(_shape, ndim)[end:-1:2]
+    neurons = Array(DataNeuron, shape...)
+    for i = 1:length(neurons)
+        neurons[i] = DataNeuron(0.0f0)
+    end
+    value_shape = [shape..., net.batch_size]
+    if per_step
+        push!(value_shape, net.time_steps)
+    end
+    value = zeros(Float32, value_shape...)
+    setter = target == :data ? :set_sequence_data_pointer : :set_sequence_label_pointer
+    for id in (train_id, test_id)
+        ccall((setter, $libIO), Void, (Cint, Ptr{Float32}), id, value)
+    end
+    ens = SequenceDataEnsemble(target, neurons, value, train_id, test_id, per_step)
+    add_ensemble(net, ens)
+    ens
+end
+
+"""
+Read variable length sequences packed in HDF5 files, padded to
+`net.time_steps`.  `bucket_pool` batches at a time are sorted by length so
+that every batch holds sequences of similar lengths, 0 disables bucketing.
+The number of steps of the longest sequence of the current batch is
+`batch_time_steps` of the returned ensembles.
+"""
+@eval function SequenceDataLayer(net::Net, train_data_source::AbstractString,
+                                 test_data_source::AbstractString;
+                                 shuffle=true, bucket_pool=32)
+    batch_size = net.batch_size
+    @assert(batch_size > 0, "Data Layer batch_size must be greater than 0")
+    train_data_source = parse_hdf5_source(train_data_source)
+    test_data_source = parse_hdf5_source(test_data_source)
+    train_id = ccall((:init_sequence_dataset, $libIO), Cint,
+                     (Cint, Cint, Ptr{UInt8}, Cuchar, Cuchar, Cint),
+                     batch_size, net.time_steps, train_data_source, shuffle, LATTE_MPI, bucket_pool)
+    test_id = ccall((:init_sequence_dataset, $libIO), Cint,
+                    (Cint, Cint, Ptr{UInt8}, Cuchar, Cuchar, Cint),
+                    batch_size, net.time_steps, test_data_source, false, LATTE_MPI, bucket_pool)
+    SequenceDataEnsemble(net, train_id, test_id, :data), SequenceDataEnsemble(net, train_id, test_id, :label)
+end
@@ -34,9 +34,12 @@ type SolverState
     obj_val :: Float32
     learning_rate :: Float32
     momentum :: Float32
+    # The last gradients were applied by apply_updates, the update tasks of
+    # the next forward have nothing left to do
+    updated :: Bool
     accuracy_log :: IOStream
     loss_log :: IOStream
-    SolverState(iter::Int, obj_val::Float32, learning_rate::Float32, momentum::Float32) = new(iter, obj_val, learning_rate, momentum)
+    SolverState(iter::Int, obj_val::Float32, learning_rate::Float32, momentum::Float32) = new(iter, obj_val, learning_rate, momentum, false)
 end
 
 abstract LearningRatePolicy
@@ -129,6 +132,11 @@ type SolverParameters
     max_epoch::Int
     regu_coef::Float32
     snapshot_dir::AbstractString
+    # Iterations every rank takes on its own gradients before the replicas
+    # average their parameters, 1 sums the gradients every iteration.  Local
+    # gradients are scaled by the number of replicas, like the summed ones.
+    local_steps::Int
+    local_momentum::Symbol
 end
 
 function SolverParameters(;
@@ -136,11 +144,15 @@ function SolverParameters(;
         mom_policy=MomPolicy.Fixed(0.9), 
         max_epoch=300,
         regu_coef=.0005, 
-        snapshot_dir="")
+        snapshot_dir="",
+        local_steps=1,
+        local_momentum=:average)
     if snapshot_dir == ""
         snapshot_dir = string(now())
     end
-    SolverParameters(lr_policy, mom_policy, max_epoch, regu_coef, snapshot_dir)
+    @assert(local_steps > 0, "local_steps must be greater than 0")
+    SolverParameters(lr_policy, mom_policy, max_epoch, regu_coef, snapshot_dir,
+                     local_steps, local_momentum)
 end
 
 type SGD <: Solver
@@ -150,6 +162,9 @@ type SGD <: Solver
 end
 
 function update(solver::Solver, net::Net, param_id::UInt64)
+    if solver.state.updated
+        return
+    end
     for param in net.params
         if object_id(param) == param_id
             update(solver, param)
@@ -167,7 +182,7 @@ function update(sgd::SGD, net::Net)
 end
 
 function update(sgd::SGD, param::Param)
-    @latte_mpi(@eval(ccall((:wait, $libComm), Void, (Cint,), $(param.request))))
+    @latte_comm(@eval(ccall((:wait, $libComm), Void, (Cint,), $(param.request))))
     if !LOSSY_GRADIENTS
         gradient = sum(param.gradient, ndims(param.gradient))
     else
@@ -223,6 +238,17 @@ function l2_regularization(regu_coef::Float32, param::Array, gradient::Array)
     BLAS.axpy!(length(param), convert(eltype(param), 2.0 * regu_coef), pointer(param), 1, pointer(gradient), 1)
 end
 
+"""
+Apply the last gradients to every parameter of `net` now rather than in the
+next forward.
+"""
+function apply_updates(solver::Solver, net::Net)
+    for param in net.params
+        update(solver, param)
+    end
+    solver.state.updated = true
+end
+
 function cleanup(solver::Solver)
     close(solver.state.accuracy_log)
     close(solver.state.loss_log)
@@ -235,9 +261,12 @@ function solve(solver::Solver, net::Net)
                                                    solver.state)
     solver.state.momentum = get_momentum(solver.params.mom_policy,
                                          solver.state)
-    @latte_mpi broadcast_initial_params(net)
+    @latte_comm broadcast_initial_params(net)
+    @latte_comm if solver.params.local_steps > 1
+        set_local_sgd(true)
+    end
 
-    @latte_mpi(if get_inter_rank(net) == 0 && get_net_subrank(net) + 1 == net.num_subgroups
+    @latte_comm(if get_inter_rank(net) == 0 && get_net_subrank(net) + 1 == net.num_subgroups
         if isdir(solver.params.snapshot_dir)
             log_info("Snapshot directory exists, overwriting.")
             rm(solver.params.snapshot_dir; recursive=true)
@@ -264,16 +293,25 @@ function solve(solver::Solver, net::Net)
         # end
         solver.state.iter += 1
         forward(net; solver=solver)
+        solver.state.updated = false
         clear_∇(net)
         backward(net)
+        @latte_comm flush_gradients(net)
 
         solver.state.obj_val = get_loss(net)
         solver.state.learning_rate = get_learning_rate(solver.params.lr_policy, solver.state)
         solver.state.momentum = get_momentum(solver.params.mom_policy, solver.state)
+        @latte_comm if solver.params.local_steps > 1 &&
+                solver.state.iter % solver.params.local_steps == 0
+            # The replicas average the parameters this iteration steps them
+            # to, tests and snapshots then see a single model
+            apply_updates(solver, net)
+            average_params(net; momentum=solver.params.local_momentum)
+        end
 
         clear_values(net)
         if solver.state.iter % 20 == 0
-            @latte_mpi(if get_net_subrank(net) + 1 == net.num_subgroups
+            @latte_comm(if get_net_subrank(net) + 1 == net.num_subgroups
                 log_info("Iter $(solver.state.iter) - Loss: $(solver.state.obj_val)")
                 if get_inter_rank(net) == 0 && get_net_subrank(net) + 1 == net.num_subgroups
                     write(solver.state.loss_log, "$(solver.state.iter),$(solver.state.obj_val)\n")
@@ -283,13 +321,13 @@ function solve(solver::Solver, net::Net)
                 write(solver.state.loss_log, "$(solver.state.iter),$(solver.state.obj_val)\n")
             end)
         end
-        @latte_mpi if net.num_subgroups > 1
+        @latte_comm if net.num_subgroups > 1
             sync_intra_train_epoch(net)
         end
         if curr_train_epoch != net.train_epoch
             log_info("Epoch $(curr_train_epoch) - Testing...")
             acc = test(net)
-            @latte_mpi(if get_net_subrank(net) + 1 == net.num_subgroups
+            @latte_comm(if get_net_subrank(net) + 1 == net.num_subgroups
                 total_acc = @eval ccall((:reduce_accuracy, $libComm), Cfloat, (Cfloat,), $acc)
                 if total_acc >= 0.0f0 && get_inter_rank(net) == 0
                     log_info("Epoch $(curr_train_epoch) - Test Result: $total_acc%")
@@ -51,6 +51,7 @@ include("layers/softmax-loss.jl")
 include("layers/accuracy.jl")
 include("layers/hdf5-data.jl")
 include("layers/memory-data.jl")
+include("layers/sequence-data.jl")
 include("layers/dropout.jl")
 include("layers/math.jl")
 include("layers/lstm.jl")
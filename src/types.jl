@@ -216,7 +216,7 @@ Main `Net` constructor that should be used.
 """
 function Net(batch_size::Int; time_steps=1, num_subgroups=1)
     net = Net(batch_size, time_steps, num_subgroups)
-    @latte_mpi initialize_communicators(net)
+    @latte_comm initialize_communicators(net)
     net
 end
 
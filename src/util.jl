@@ -199,7 +199,7 @@ end
 
 function log_info(args...)
     _time = string(Libc.strftime("%d-%b %H:%M:%S",time())," - ")
-    if LATTE_MPI
+    if LATTE_COMM
         rank = @eval ccall((:get_rank, $libComm), Cint, ())
         Base.info(_time, "RANK $rank: ",  args...)
     else
@@ -336,3 +336,16 @@ macro latte_mpi(args...)
     end
 end
 
+"""
+Defines @expr only if LATTE_COMM is enabled, with any transport
+"""
+macro latte_comm(args...)
+    if length(args) == 2
+        LATTE_COMM ? esc(args[1]) : args[2]
+    elseif length(args) == 1
+        LATTE_COMM ? esc(args[1]) : nothing
+    else
+        @assert false
+    end
+end
+
@@ -46,6 +46,7 @@ include("stdlib/test_pooling.jl")
 include("stdlib/test_relu.jl")
 include("stdlib/test_reshape.jl")
 include("stdlib/test_rnn.jl")
+include("stdlib/test_sequence-data.jl")
 include("stdlib/test_softmax.jl")
 include("stdlib/test_tanh.jl")
 include("stdlib/test_transform.jl")
@@ -0,0 +1,115 @@
+#=
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+=#
+
+# Trains a small net data parallel over the shared memory transport, without
+# MPI.  Run as a plain script, it writes the dataset and starts the ranks.
+
+using HDF5
+
+const num_ranks = 2
+const shard_items = 8
+const _file = "temp_shm"
+
+if !haskey(ENV, "LATTE_SHM_RANK")
+    # Item i of the dataset is filled with i, one shard per rank
+    open("$_file.txt", "w") do manifest
+        for rank = 0:num_ranks - 1
+            first = rank * shard_items
+            h5open("$(_file)_$rank.hdf5", "w") do h5
+                data_value = Array(Float32, 4, 4, 1, shard_items)
+                for i = 1:shard_items
+                    data_value[:,:,:,i] = first + i - 1
+                end
+                h5["data"] = data_value
+                h5["label"] = reshape(Float32[first:first + shard_items - 1;], 1, shard_items)
+            end
+            println(manifest, "$(_file)_$rank.hdf5")
+        end
+    end
+    ranks = Base.Process[]
+    for rank = 0:num_ranks - 1
+        env = Dict{AbstractString,AbstractString}()
+        for (key, value) in ENV
+            env[key] = value
+        end
+        env["LATTE_TRANSPORT"] = "shm"
+        env["LATTE_SHM_RANK"] = string(rank)
+        env["LATTE_SHM_SIZE"] = string(num_ranks)
+        env["LATTE_SHM_JOB"] = "test_shm_$(getpid())"
+        push!(ranks, spawn(setenv(`$(Base.julia_cmd()) $(@__FILE__)`, env)))
+    end
+    for process in ranks
+        wait(process)
+    end
+    for rank = 0:num_ranks - 1
+        rm("$(_file)_$rank.hdf5")
+    end
+    rm("$_file.txt")
+    isdir("$(_file)_snapshots") && rm("$(_file)_snapshots"; recursive=true)
+    exit(all(success, ranks) ? 0 : 1)
+end
+
+using Latte
+using FactCheck
+
+rank = Latte.get_rank()
+
+net = Net(4)
+data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false)
+fc = InnerProductLayer(:fc, net, data, 10)
+loss = SoftmaxLossLayer(:loss, net, fc, label)
+
+params = SolverParameters(
+    lr_policy    = LRPolicy.Fixed(.01f0),
+    mom_policy   = MomPolicy.Fixed(0.9),
+    max_epoch    = 2,
+    regu_coef    = .0005,
+    snapshot_dir = "$(_file)_snapshots")
+sgd = SGD(params)
+
+facts("Testing data parallel training over shared memory") do
+    solve(sgd, net)
+
+    context("Every rank reads its own shard") do
+        forward(net; phase=Test)
+        for value in get_buffer(net, :labelvalue)
+            @fact div(round(Int, value), shard_items) --> rank
+        end
+        @fact all(get_buffer(net, :datavalue)[:,:,:,1] .== get_buffer(net, :labelvalue)[1]) --> true
+    end
+
+    context("The replicas end with the same parameters") do
+        for param in net.params
+            value = copy(param.value)
+            @eval ccall((:broadcast_inter, $(Latte.libComm)), Void, (Ptr{Float32}, Cint, Cint),
+                        $value, length($value), 0)
+            @fact param.value --> roughly(value)
+        end
+    end
+end
+
+FactCheck.exitstatus()
@@ -28,6 +28,50 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 using Latte
 using FactCheck
 using HDF5
+
+# A half precision HDF5 type, derived from single precision as in
+# deps/IO/sample_types.h
+function half_datatype()
+    half = HDF5.h5t_copy(HDF5.H5T_NATIVE_FLOAT)
+    ccall((:H5Tset_fields, HDF5.libhdf5), HDF5.Herr,
+          (HDF5.Hid, Csize_t, Csize_t, Csize_t, Csize_t, Csize_t), half, 15, 10, 5, 0, 10)
+    ccall((:H5Tset_size, HDF5.libhdf5), HDF5.Herr, (HDF5.Hid, Csize_t), half, 2)
+    ccall((:H5Tset_ebias, HDF5.libhdf5), HDF5.Herr, (HDF5.Hid, Csize_t), half, 15)
+    ccall((:H5Tset_precision, HDF5.libhdf5), HDF5.Herr, (HDF5.Hid, Csize_t), half, 16)
+    HDF5Datatype(half)
+end
+
+# Write /data and /label to $name.hdf5 and a source $name.txt listing it.
+# /data is stored as storage_type, UInt8 or Float16 samples are converted
+# from data_value, which must be representable, and given the scale
+# attribute unless it is nothing.
+function write_hdf5_dataset(name, data_value, label_value; storage_type=Float32, scale=nothing)
+    h5open("$name.hdf5", "w") do h5
+        file_type = storage_type == Float16 ? half_datatype() : datatype(storage_type)
+        dset_data = d_create(h5, "data", file_type, dataspace(size(data_value)...))
+        dset_label = d_create(h5, "label", datatype(Float32), dataspace(size(label_value)...))
+        if storage_type == UInt8
+            dset_data[[Colon() for _ in 1:ndims(data_value)]...] = map(UInt8, data_value)
+        else
+            # HDF5 narrows Float32 to the file type
+            HDF5.h5d_write(dset_data.id, HDF5.H5T_NATIVE_FLOAT, HDF5.H5S_ALL, HDF5.H5S_ALL,
+                           HDF5.H5P_DEFAULT, convert(Array{Float32}, data_value))
+        end
+        if scale != nothing
+            attrs(dset_data)["scale"] = convert(Float32, scale)
+        end
+        dset_label[:,:] = label_value
+    end
+    open("$name.txt", "w") do f
+        write(f, "$name.hdf5")
+    end
+end
+
+function remove_hdf5_dataset(name)
+    rm("$name.txt")
+    rm("$name.hdf5")
+end
+
 facts("Testing HDF5 Layer") do
     _file = "temp"
 
@@ -68,4 +112,446 @@ facts("Testing HDF5 Layer") do
     rm("$_file.hdf5")
 end
 
+facts("Testing HDF5 Layer windows") do
+    _file = "temp_window"
+
+    w, h, c, n = 8, 6, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    # Labels number the items
+    label_value = reshape(Float32[0:n-1;], 1, n)
+    write_hdf5_dataset(_file, data_value, label_value)
+    item_bytes = (w * h * c + 1) * sizeof(Float32)
+
+    context("Unshuffled windows keep the file order") do
+        net = Net(4)
+        # Windows of 8 items made of 2 slabs
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false,
+                                    memory_budget=8 * item_bytes, window_slabs=2)
+        init(net)
+        for i = [1:4; 1]
+            forward(net)
+            items = 4 * (i - 1) + 1:4 * i
+            @fact get_buffer(net, :datavalue) --> data_value[:,:,:,items]
+            @fact get_buffer(net, :labelvalue) --> label_value[:,items]
+        end
+    end
+
+    context("Shuffled windows read every item once per epoch") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=true,
+                                    memory_budget=8 * item_bytes, window_slabs=2)
+        init(net)
+        for epoch = 1:2
+            seen = Int[]
+            for i = 1:4
+                forward(net)
+                labels = round(Int, get_buffer(net, :labelvalue)[:])
+                @fact get_buffer(net, :datavalue) --> data_value[:,:,:,labels + 1]
+                append!(seen, labels)
+            end
+            @fact sort(seen) --> [0:n-1;]
+        end
+    end
+    remove_hdf5_dataset(_file)
+end
+
+facts("Testing HDF5 Layer chunked storage") do
+    _file = "temp_chunked"
+
+    w, h, c, n = 8, 6, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = reshape(Float32[0:n-1;], 1, n)
+    # Storage chunks of 3 items do not line up with the batches
+    h5open("$_file.hdf5", "w") do h5
+        dset_data = d_create(h5, "data", datatype(Float32), dataspace(w, h, c, n),
+                             "chunk", (w, h, c, 3), "compress", 6)
+        dset_data[:,:,:,:] = data_value
+        h5["label"] = label_value
+    end
+    open("$_file.txt", "w") do f
+        write(f, "$_file.hdf5")
+    end
+
+    context("Unshuffled batches keep the file order") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false)
+        init(net)
+        for i = [1:4; 1]
+            forward(net)
+            items = 4 * (i - 1) + 1:4 * i
+            @fact get_buffer(net, :datavalue) --> data_value[:,:,:,items]
+            @fact get_buffer(net, :labelvalue) --> label_value[:,items]
+        end
+    end
+
+    context("Shuffled batches read every item once per epoch") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=true)
+        init(net)
+        for epoch = 1:2
+            seen = Int[]
+            for i = 1:4
+                forward(net)
+                labels = round(Int, get_buffer(net, :labelvalue)[:])
+                @fact get_buffer(net, :datavalue) --> data_value[:,:,:,labels + 1]
+                append!(seen, labels)
+            end
+            @fact sort(seen) --> [0:n-1;]
+        end
+    end
+    remove_hdf5_dataset(_file)
+end
+
+# Write float32 data and labels in the Latte raw format (deps/IO/raw_format.h)
+# to name.raw and list it in name.txt
+function write_raw_dataset(name, data_value, label_value)
+    align(offset) = div(offset + 4095, 4096) * 4096
+    # Item-major C order shapes
+    data_shape = Int64[reverse([size(data_value)...]);]
+    label_shape = Int64[reverse([size(label_value)...]);]
+    header_size = 184
+    data_offset = align(header_size)
+    label_offset = align(data_offset + sizeof(data_value))
+    open("$name.raw", "w") do f
+        write(f, "LATTERAW")
+        write(f, Int32[1, 0, length(data_shape), length(label_shape)])
+        write(f, [data_shape; zeros(Int64, 8 - length(data_shape))])
+        write(f, [label_shape; zeros(Int64, 8 - length(label_shape))])
+        write(f, UInt64[data_offset, label_offset, label_offset + sizeof(label_value)])
+        write(f, Float32[1])
+        write(f, zeros(UInt8, data_offset - position(f)))
+        write(f, convert(Array{Float32}, data_value))
+        write(f, zeros(UInt8, label_offset - position(f)))
+        write(f, convert(Array{Float32}, label_value))
+    end
+    open("$name.txt", "w") do f
+        write(f, "$name.raw")
+    end
+end
+
+facts("Testing HDF5 Layer raw files") do
+    _file = "temp_raw"
+
+    w, h, c, n = 8, 6, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = reshape(Float32[0:n-1;], 1, n)
+    write_raw_dataset(_file, data_value, label_value)
+
+    context("The data shape is read from the header") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false)
+        ndim = @eval ccall((:get_data_ndim, $(Latte.libIO)), Cint, (Cint,), $(data.train_id))
+        shape = @eval ccall((:get_data_shape, $(Latte.libIO)), Ptr{Cint}, (Cint,), $(data.train_id))
+        @fact pointer_to_array(shape, ndim) --> Cint[n, c, h, w]
+        @fact size(data) --> (w, h, c)
+    end
+
+    context("Unshuffled batches keep the file order") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false)
+        init(net)
+        for i = [1:4; 1]
+            forward(net)
+            items = 4 * (i - 1) + 1:4 * i
+            @fact get_buffer(net, :datavalue) --> data_value[:,:,:,items]
+            @fact get_buffer(net, :labelvalue) --> label_value[:,items]
+        end
+    end
+
+    context("Shuffled batches read every item once per epoch") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=true)
+        init(net)
+        for epoch = 1:2
+            seen = Int[]
+            for i = 1:4
+                forward(net)
+                labels = round(Int, get_buffer(net, :labelvalue)[:])
+                @fact get_buffer(net, :datavalue) --> data_value[:,:,:,labels + 1]
+                append!(seen, labels)
+            end
+            @fact sort(seen) --> [0:n-1;]
+        end
+    end
+    rm("$_file.txt")
+    rm("$_file.raw")
+end
+
+facts("Testing HDF5 Layer sharded datasets") do
+    _file = "temp_sharded"
+
+    w, h, c, n = 8, 6, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = reshape(Float32[0:n-1;], 1, n)
+    item_bytes = (w * h * c + 1) * sizeof(Float32)
+    # Shards of 6, 5 and 5 items, the second one listed with its size
+    bounds = [1:6, 7:11, 12:16]
+    open("$_file.txt", "w") do manifest
+        for (i, items) in enumerate(bounds)
+            write_hdf5_dataset("$(_file)_$i", data_value[:,:,:,items], label_value[:,items])
+            println(manifest, i == 2 ? "$(_file)_$i.hdf5 $(length(items))" : "$(_file)_$i.hdf5")
+        end
+    end
+
+    context("Windows span shard boundaries and wrap around at the epoch") do
+        net = Net(4)
+        # Windows of 8 items made of 2 slabs, items 5 to 8 and 9 to 12
+        # straddle the shards
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false,
+                                    memory_budget=8 * item_bytes, window_slabs=2)
+        init(net)
+        for i = [1:4; 1:2]
+            forward(net)
+            items = 4 * (i - 1) + 1:4 * i
+            @fact get_buffer(net, :datavalue) --> data_value[:,:,:,items]
+            @fact get_buffer(net, :labelvalue) --> label_value[:,items]
+        end
+    end
+
+    context("Shuffled epochs read every item once with one shard open") do
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=true,
+                                    memory_budget=8 * item_bytes, window_slabs=2,
+                                    max_open_files=1)
+        init(net)
+        for epoch = 1:2
+            seen = Int[]
+            for i = 1:4
+                forward(net)
+                labels = round(Int, get_buffer(net, :labelvalue)[:])
+                @fact get_buffer(net, :datavalue) --> data_value[:,:,:,labels + 1]
+                append!(seen, labels)
+            end
+            @fact sort(seen) --> [0:n-1;]
+        end
+    end
+    for i = 1:length(bounds)
+        remove_hdf5_dataset("$(_file)_$i")
+    end
+    rm("$_file.txt")
+end
+
+facts("Testing HDF5 Layer streaming") do
+    _file = "temp_streaming"
+
+    w, h, c, n = 8, 6, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = reshape(Float32[0:n-1;], 1, n)
+    write_hdf5_dataset(_file, data_value, label_value)
+
+    function read_batches(num_batches; options...)
+        net = Net(4)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; options...)
+        init(net)
+        batches = Any[]
+        for i = 1:num_batches
+            forward(net)
+            push!(batches, (copy(get_buffer(net, :datavalue)), copy(get_buffer(net, :labelvalue))))
+        end
+        batches
+    end
+
+    context("Read ahead batches match those of a resident window") do
+        streamed = read_batches(6; shuffle=false, streaming=true, read_ahead=3)
+        resident = read_batches(6; shuffle=false)
+        @fact streamed --> resident
+    end
+
+    context("Shuffled epochs yield every item exactly once") do
+        batches = read_batches(8; shuffle=true, streaming=true, read_ahead=3)
+        for epoch = 1:2
+            seen = Int[]
+            for (value, label) in batches[4 * (epoch - 1) + 1:4 * epoch]
+                labels = round(Int, label[:])
+                @fact value --> data_value[:,:,:,labels + 1]
+                append!(seen, labels)
+            end
+            @fact sort(seen) --> [0:n-1;]
+        end
+    end
+    remove_hdf5_dataset(_file)
+end
+
+facts("Testing HDF5 Layer storage types") do
+    w, h, c, n = 8, 6, 3, 8
+    # Integers up to 255 are exact in uint8 and fp16
+    data_value = map(Float32, rand(0:255, w, h, c, n))
+    label_value = map(floor, rand(Float32, 1, n) * 10)
+
+    function read_batch(name)
+        net = Net(n)
+        data, label = HDF5DataLayer(net, "$name.txt", "$name.txt"; shuffle=false)
+        init(net)
+        forward(net)
+        @fact get_buffer(net, :labelvalue) --> label_value
+        copy(get_buffer(net, :datavalue))
+    end
+
+    write_hdf5_dataset("temp_float32", data_value, label_value)
+    write_hdf5_dataset("temp_float16", data_value, label_value; storage_type=Float16)
+    write_hdf5_dataset("temp_uint8", data_value, label_value; storage_type=UInt8, scale=1)
+    write_hdf5_dataset("temp_uint8_scaled", data_value, label_value; storage_type=UInt8)
+
+    @fact read_batch("temp_float32") --> data_value
+    @fact read_batch("temp_float16") --> data_value
+    @fact read_batch("temp_uint8") --> data_value
+    # uint8 samples are scaled by 1 / 255 without a scale attribute
+    @fact read_batch("temp_uint8_scaled") --> roughly(data_value / 255)
+    for name in ["temp_float32", "temp_float16", "temp_uint8", "temp_uint8_scaled"]
+        remove_hdf5_dataset(name)
+    end
+end
+
+facts("Testing HDF5 Layer transforms") do
+    _file = "temp_transform"
+
+    w, h, c, n = 8, 6, 3, 8
+    crop_h, crop_w = 4, 6
+    scale = 0.5f0
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = map(floor, rand(Float32, 1, n) * 10)
+    mean_value = rand(Float32, w, h, c) * 256
+    write_hdf5_dataset(_file, data_value, label_value)
+    h5open("$(_file)_mean.hdf5", "w") do h5
+        h5["mean"] = mean_value
+    end
+
+    # Item i cropped at offset (x, y), mean subtracted, scaled and mirrored
+    function reference(i, x, y, flip)
+        xs = x + 1:x + crop_w
+        ys = y + 1:y + crop_h
+        item = (data_value[xs, ys, :, i] - mean_value[xs, ys, :]) * scale
+        flip ? flipdim(item, 1) : item
+    end
+
+    net = Net(n)
+    data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false,
+                                mean_file="$(_file)_mean.hdf5", scale=scale,
+                                crop=(crop_h, crop_w), mirror=true)
+    init(net)
+
+    context("Test items are center cropped") do
+        forward(net; phase=Test)
+        value = get_buffer(net, :datavalue)
+        @fact size(value) --> (crop_w, crop_h, c, n)
+        for i = 1:n
+            @fact value[:,:,:,i] --> roughly(reference(i, div(w - crop_w, 2), div(h - crop_h, 2), false))
+        end
+        @fact get_buffer(net, :labelvalue) --> label_value
+    end
+
+    context("Training items are randomly cropped and mirrored") do
+        flips = Bool[]
+        for iter = 1:4
+            forward(net)
+            value = get_buffer(net, :datavalue)
+            for i = 1:n
+                # The crop offset and mirroring item i was drawn with
+                found = false
+                for x = 0:w - crop_w, y = 0:h - crop_h, flip = [false, true]
+                    if !found && isapprox(value[:,:,:,i], reference(i, x, y, flip))
+                        found = true
+                        push!(flips, flip)
+                    end
+                end
+                @fact found --> true
+            end
+        end
+        @fact any(flips) --> true
+        @fact all(flips) --> false
+    end
+    remove_hdf5_dataset(_file)
+    rm("$(_file)_mean.hdf5")
+
+    context("A scale alone applies to data that is not 4D") do
+        n = 8
+        data_value = rand(Float32, 5, 2, n) * 256
+        label_value = map(floor, rand(Float32, 1, n) * 10)
+        write_hdf5_dataset(_file, data_value, label_value)
+        net = Net(n)
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false,
+                                    scale=scale)
+        init(net)
+        forward(net)
+        @fact get_buffer(net, :datavalue) --> roughly(data_value * scale)
+        forward(net; phase=Test)
+        @fact get_buffer(net, :datavalue) --> roughly(data_value * scale)
+        remove_hdf5_dataset(_file)
+    end
+end
+
+facts("Testing HDF5 Layer state") do
+    _file = "temp_state"
+
+    w, h, c, n = 8, 6, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = reshape(Float32[0:n-1;], 1, n)
+    write_hdf5_dataset(_file, data_value, label_value)
+    item_bytes = (w * h * c + 1) * sizeof(Float32)
+
+    function open_net()
+        net = Net(4)
+        # Windows of half the file, so that the state spans windows and epochs
+        data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=true, seed=42,
+                                    memory_budget=8 * item_bytes, window_slabs=2)
+        init(net)
+        net, data
+    end
+
+    function next_batches(net, num_batches)
+        batches = []
+        for i = 1:num_batches
+            forward(net)
+            push!(batches, (copy(get_buffer(net, :datavalue)), copy(get_buffer(net, :labelvalue))))
+        end
+        batches
+    end
+
+    net, data = open_net()
+    next_batches(net, 3)
+    state = save_dataset_state(data)
+    expected = next_batches(net, 6)
+
+    context("A restored dataset repeats the batches after the saved one") do
+        restore_dataset_state(data, state)
+        @fact next_batches(net, 6) --> expected
+    end
+
+    context("A dataset opened the same way continues from a saved state") do
+        other, other_data = open_net()
+        restore_dataset_state(other_data, state)
+        @fact next_batches(other, 6) --> expected
+    end
+    remove_hdf5_dataset(_file)
+end
+
+
+facts("Testing HDF5 Layer shared buffers") do
+    _file = "temp_shared"
+
+    w, h, c, n = 32, 32, 3, 16
+    data_value = rand(Float32, w, h, c, n) * 256
+    label_value = map(floor, rand(Float32, 1, n) * 10)
+    write_hdf5_dataset(_file, data_value, label_value)
+
+    arena_bytes() = @eval ccall((:get_arena_bytes, $(Latte.libIO)), Csize_t, ())
+
+    net = Net(8)
+    data, label = HDF5DataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false,
+                                share_buffers=true)
+    init(net)
+
+    context("Train and test windows take turns in the same memory") do
+        forward(net)
+        train_bytes = arena_bytes()
+        forward(net; phase=Test)
+        @fact arena_bytes() --> train_bytes
+        @fact get_buffer(net, :datavalue) --> data_value[:,:,:,1:8]
+        forward(net)
+        @fact arena_bytes() --> train_bytes
+        @fact get_buffer(net, :datavalue) --> data_value[:,:,:,9:16]
+    end
+    remove_hdf5_dataset(_file)
+end
+
 FactCheck.exitstatus()
@@ -0,0 +1,98 @@
+#=
+Copyright (c) 2015, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+=#
+
+using Latte
+using FactCheck
+using HDF5
+facts("Testing Sequence Data Layer") do
+    _file = "temp_sequence"
+
+    c = 3
+    max_steps = 4
+    lengths = [3, 1, 6, 2, 5]
+    offsets = [0; cumsum(lengths)]
+
+    # Step r of the packed data is 100r + 1, ..., 100r + c
+    data_value = Float32[100 * r + k for k = 1:c, r = 0:offsets[end]-1]
+    label_value = reshape(Float32[1:length(lengths);], 1, length(lengths))
+
+    h5open("$_file.hdf5", "w") do h5
+        h5["data"] = data_value
+        h5["offsets"] = offsets
+        h5["label"] = label_value
+    end
+
+    open("$_file.txt", "w") do f
+        write(f, "$_file.hdf5")
+    end
+
+    # Padded batch of the 0-based sequences seqs
+    function expected_batch(seqs)
+        value = zeros(Float32, c, length(seqs), max_steps)
+        for (i, s) in enumerate(seqs)
+            for t = 1:min(lengths[s + 1], max_steps)
+                value[:, i, t] = data_value[:, offsets[s + 1] + t]
+            end
+        end
+        value
+    end
+
+    function check_batch(net, data, label, seqs)
+        value = expected_batch(seqs)
+        @fact data.value --> value
+        @fact label.value --> label_value[:, seqs + 1]
+        expected_lengths = [min(lengths[s + 1], max_steps) for s in seqs]
+        _lengths = @eval ccall((:get_sequence_lengths, $(Latte.libIO)), Ptr{Cint}, (Cint,), $(data.train_id))
+        @fact pointer_to_array(_lengths, length(seqs)) --> expected_lengths
+        @fact data.batch_time_steps --> maximum(expected_lengths)
+        for t = 1:max_steps
+            @fact get_buffer(net, :datavalue, t) --> value[:, :, t]
+        end
+    end
+
+    net = Net(2; time_steps=max_steps)
+    data, label = SequenceDataLayer(net, "$_file.txt", "$_file.txt"; shuffle=false, bucket_pool=2)
+
+    init(net)
+    # The last sequence sits out, the others are sorted by length into
+    # batches [1, 3] and [0, 2]
+    forward(net)
+    check_batch(net, data, label, [1, 3])
+    # Epochs are numbered from 1
+    @fact net.train_epoch --> 1
+    # Sequence 2 is truncated to max_steps
+    forward(net)
+    check_batch(net, data, label, [0, 2])
+    @fact net.train_epoch --> 2
+    # Test wrap around
+    forward(net)
+    check_batch(net, data, label, [1, 3])
+    rm("$_file.txt")
+    rm("$_file.hdf5")
+end
+
+FactCheck.exitstatus()
@@ -30,11 +30,16 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <math.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 // #include <mpi.h>
 #include "hdf5.h"
+#include "../../deps/IO/raw_format.h"
 
 // #define MPI_OUT std::cout << "Worker " << MPI::COMM_WORLD.Get_rank() << ": "
 #define MPI_OUT std::cout << "Worker " << 0 << ": "
@@ -51,6 +56,40 @@ hid_t create_hdf5_file(std::string file_name) {
     return file_id;
 }
 
+// Create a raw format file (see deps/IO/raw_format.h) of the size described by
+// header and map it for writing
+char* create_raw_file(std::string file_name, RawHeader *header) {
+    MPI_OUT << "Creating raw File:" << file_name << std::endl;
+    raw_header_layout(header);
+    int fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, header->file_size) != 0) {
+        std::cout << "Error: could not create " << file_name << std::endl;
+        exit(-1);
+    }
+    char *base = (char *) mmap(NULL, header->file_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "Error: could not map " << file_name << std::endl;
+        exit(-1);
+    }
+    memcpy(base, header, sizeof(RawHeader));
+    return base;
+}
+
+// Convert n samples in [0, 1] to the storage type of the dataset
+void pack_samples(const float *src, char *dst, int n, int sample_type) {
+    for (int i = 0; i < n; i++) {
+        if (sample_type == SAMPLE_UINT8) {
+            ((uint8_t *) dst)[i] = (uint8_t) lrintf(src[i] * 255.0f);
+        } else if (sample_type == SAMPLE_FLOAT16) {
+            ((uint16_t *) dst)[i] = float_to_half(src[i]);
+        } else {
+            ((float *) dst)[i] = src[i];
+        }
+    }
+}
+
 void read_metadata(std::string metadata_file,
                      std::vector<std::pair<std::string, int> > &lines) {
     MPI_OUT << "Parsing image list: " << metadata_file << std::endl;
@@ -70,16 +109,48 @@ int main(int argc, char *argv[]) {
     // int mpi_size = MPI::COMM_WORLD.Get_size();
     int mpi_size = 1;
 
-    if (argc < 3) {
-    std::cout << "Error: Usage - convert $size $target_file_name $metadata_file $(mean_file_name, optional)" << std::endl;
+    // Leading --options, the remaining arguments are positional
+    bool write_raw = false;
+    int sample_type = SAMPLE_FLOAT32;
+    // Items per storage chunk of /data (0 for a contiguous dataset) and
+    // deflate level (-1 for none).  Use a multiple of the training batch size.
+    int chunk_items = 0;
+    int deflate_level = -1;
+    std::vector<char *> args;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--raw") == 0) {
+            write_raw = true;
+        } else if (strcmp(argv[i], "--dtype=uint8") == 0) {
+            sample_type = SAMPLE_UINT8;
+        } else if (strcmp(argv[i], "--dtype=fp16") == 0) {
+            sample_type = SAMPLE_FLOAT16;
+        } else if (strcmp(argv[i], "--dtype=float32") == 0) {
+            sample_type = SAMPLE_FLOAT32;
+        } else if (strncmp(argv[i], "--chunk=", 8) == 0) {
+            chunk_items = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--deflate=", 10) == 0) {
+            deflate_level = atoi(argv[i] + 10);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() < 4) {
+    std::cout << "Error: Usage - convert [--raw] [--dtype=float32|fp16|uint8] [--chunk=items] [--deflate=level] $size $target_file_name $metadata_file $(mean_file_name, optional)" << std::endl;
     return -1;
     }
-    bool compute_mean = argc == 5;
-    int size = atoi(argv[1]);
-    std::string target_file_name(argv[2]);
-    std::string metadata_file(argv[3]);
-
-    hid_t file_id = create_hdf5_file(target_file_name);
+    if (deflate_level >= 0 && chunk_items <= 0) {
+        // Filters need a chunked layout, default to a multiple of the usual
+        // batch sizes
+        chunk_items = 256;
+    }
+    if (write_raw && chunk_items > 0) {
+        std::cout << "Error: --chunk and --deflate only apply to HDF5 output" << std::endl;
+        return -1;
+    }
+    bool compute_mean = args.size() == 5;
+    int size = atoi(args[1]);
+    std::string target_file_name(args[2]);
+    std::string metadata_file(args[3]);
 
     std::vector<std::pair<std::string, int> > lines;
     read_metadata(metadata_file, lines);
@@ -94,18 +165,61 @@ int main(int argc, char *argv[]) {
 
     hsize_t dim_data[] = {lines.size(), channels, height, width};
     hsize_t dim_label[] = {lines.size(), 1};
-    hid_t data_dataspace = H5Screate_simple(4, dim_data, NULL);
-    hid_t label_dataspace = H5Screate_simple(2, dim_label, NULL);
+    hid_t file_id, dset_data_id, dset_label_id;
+    // uint8 samples hold unnormalized pixels, readers apply data_scale
+    float data_scale = sample_type == SAMPLE_UINT8 ? 1.0f / 255.0f : 1.0f;
+    hid_t data_type = sample_hdf5_type(sample_type);
+    RawHeader raw_header;
+    char *raw_base = NULL;
+    if (write_raw) {
+        raw_header_init(&raw_header, sample_type);
+        raw_header.data_scale = data_scale;
+        raw_header.data_ndim = 4;
+        raw_header.label_ndim = 2;
+        for (int i = 0; i < 4; i++) raw_header.data_shape[i] = dim_data[i];
+        for (int i = 0; i < 2; i++) raw_header.label_shape[i] = dim_label[i];
+        raw_base = create_raw_file(target_file_name, &raw_header);
+    } else {
+        file_id = create_hdf5_file(target_file_name);
+        hid_t data_dataspace = H5Screate_simple(4, dim_data, NULL);
+        hid_t label_dataspace = H5Screate_simple(2, dim_label, NULL);
 
-    MPI_OUT << "Creating Datasets" << std::endl;
-    hid_t dset_data_id = H5Dcreate(file_id, "data", H5T_NATIVE_FLOAT,
-        data_dataspace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        MPI_OUT << "Creating Datasets" << std::endl;
+        hid_t data_dcpl = H5Pcreate(H5P_DATASET_CREATE);
+        hid_t data_dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        if (chunk_items > 0) {
+            // Chunks of whole items, the reader inflates them in parallel
+            hsize_t dim_chunk[] = {std::min((hsize_t) chunk_items, dim_data[0]),
+                                   channels, height, width};
+            H5Pset_chunk(data_dcpl, 4, dim_chunk);
+            if (deflate_level >= 0) {
+                if (sample_type_size(sample_type) > 1) H5Pset_shuffle(data_dcpl);
+                H5Pset_deflate(data_dcpl, deflate_level);
+            }
+            // Items are written one at a time in file order, keep the chunk
+            // being filled cached so it is compressed once
+            size_t chunk_bytes = dim_chunk[0] * channels * height * width *
+                                 sample_type_size(sample_type);
+            H5Pset_chunk_cache(data_dapl, 521, 2 * chunk_bytes, 1.0);
+        }
+        dset_data_id = H5Dcreate(file_id, "data", data_type,
+            data_dataspace, H5P_DEFAULT, data_dcpl, data_dapl);
+        H5Pclose(data_dcpl);
+        H5Pclose(data_dapl);
 
-    hid_t dset_label_id = H5Dcreate(file_id, "label", H5T_NATIVE_FLOAT,
-        label_dataspace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t scale_space = H5Screate(H5S_SCALAR);
+        hid_t scale_attr = H5Acreate(dset_data_id, "scale", H5T_NATIVE_FLOAT, scale_space,
+            H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(scale_attr, H5T_NATIVE_FLOAT, &data_scale);
+        H5Aclose(scale_attr);
+        H5Sclose(scale_space);
 
-    H5Sclose(data_dataspace);
-    H5Sclose(label_dataspace);
+        dset_label_id = H5Dcreate(file_id, "label", H5T_NATIVE_FLOAT,
+            label_dataspace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        H5Sclose(data_dataspace);
+        H5Sclose(label_dataspace);
+    }
 
     int shuffled_indexes[lines.size()];
     if (mpi_rank == 0) {
@@ -118,33 +232,43 @@ int main(int argc, char *argv[]) {
     hsize_t start = mpi_rank * chunk_size;
     hsize_t end = (mpi_rank + 1) * chunk_size;
 
-    hid_t data_slab_space = H5Dget_space(dset_data_id);
-    hid_t label_slab_space = H5Dget_space(dset_label_id);
+    hid_t data_slab_space, label_slab_space, data_memspace, label_memspace, plist_id;
     hsize_t data_count[] = {1, channels, height, width};
     hsize_t label_count[] = {1, 1};
-    hid_t data_memspace = H5Screate_simple(4, data_count, NULL);
-    hid_t label_memspace = H5Screate_simple(2, label_count, NULL);
-
-    hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
+    if (!write_raw) {
+        data_slab_space = H5Dget_space(dset_data_id);
+        label_slab_space = H5Dget_space(dset_label_id);
+        data_memspace = H5Screate_simple(4, data_count, NULL);
+        label_memspace = H5Screate_simple(2, label_count, NULL);
+        plist_id = H5Pcreate(H5P_DATASET_XFER);
+    }
     // H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
     herr_t status;
     MPI_OUT << "Beginning conversion" << std::endl;
     float im_to_store[height*width*channels];
+    char im_packed[height*width*channels*sample_type_size(sample_type)];
     for (hsize_t i = start; i < end; i++) {
         float *label, *data;
+        int shuffled_index;
         if (i < lines.size() && shuffled_indexes[i] < lines.size()) {
             cv::Mat image, im_resized, float_im;
-            int shuffled_index = shuffled_indexes[i];
+            shuffled_index = shuffled_indexes[i];
+            // Line i goes to item shuffled_index.  Chunked datasets are
+            // filled in file order instead, item i from line shuffled_index.
+            int line = i;
+            if (chunk_items > 0) std::swap(line, shuffled_index);
             hsize_t label_offset[] = {shuffled_index, 0};
             hsize_t data_offset[] = {shuffled_index, 0, 0, 0};
-            image = cv::imread(lines[i].first, CV_LOAD_IMAGE_COLOR);
+            image = cv::imread(lines[line].first, CV_LOAD_IMAGE_COLOR);
             image.convertTo(float_im, CV_32FC3);
             cv::resize(float_im, im_resized, cv::Size(height, width));
-            H5Sselect_hyperslab(data_slab_space, H5S_SELECT_SET, data_offset, NULL,
-                data_count, NULL);
-            H5Sselect_hyperslab(label_slab_space, H5S_SELECT_SET, label_offset, NULL,
-                label_count, NULL);
-            float float_label = (float) lines[i].second;
+            if (!write_raw) {
+                H5Sselect_hyperslab(data_slab_space, H5S_SELECT_SET, data_offset, NULL,
+                    data_count, NULL);
+                H5Sselect_hyperslab(label_slab_space, H5S_SELECT_SET, label_offset, NULL,
+                    label_count, NULL);
+            }
+            float float_label = (float) lines[line].second;
             label = &float_label;
             for (int col=0; col < height; col++) {
                 for (int row=0; row < width; row++) {
@@ -157,7 +281,10 @@ int main(int argc, char *argv[]) {
                     }
                 }
             }
-            data = im_to_store;
+            pack_samples(im_to_store, im_packed, height*width*channels, sample_type);
+            data = (float *) im_packed;
+        } else if (write_raw) {
+            continue;
         } else {
             H5Sselect_none(data_memspace);
             H5Sselect_none(data_slab_space);     
@@ -166,8 +293,16 @@ int main(int argc, char *argv[]) {
             data = NULL; 
             label = NULL;
         }
-        status = H5Dwrite(dset_data_id, H5T_NATIVE_FLOAT, data_memspace, data_slab_space, plist_id, data); 
-        status = H5Dwrite(dset_label_id, H5T_NATIVE_FLOAT, label_memspace, label_slab_space, plist_id, label);
+        if (write_raw) {
+            size_t item_bytes = channels * height * width * sample_type_size(sample_type);
+            memcpy(raw_base + raw_header.data_offset + shuffled_index * item_bytes,
+                   data, item_bytes);
+            memcpy(raw_base + raw_header.label_offset + shuffled_index * sizeof(float),
+                   label, sizeof(float));
+        } else {
+            status = H5Dwrite(dset_data_id, data_type, data_memspace, data_slab_space, plist_id, data); 
+            status = H5Dwrite(dset_label_id, H5T_NATIVE_FLOAT, label_memspace, label_slab_space, plist_id, label);
+        }
         if (((int) i - start) % 100 == 0) {
             MPI_OUT << "Finished " << i - start << " of " << end - start << " images" << std::endl;
         }
@@ -175,10 +310,16 @@ int main(int argc, char *argv[]) {
     MPI_OUT << "Completed conversion" <<  std::endl;
 
     MPI_OUT << "Cleaning up" <<  std::endl;
-    H5Pclose(plist_id);
-    H5Dclose(dset_data_id);
-    H5Dclose(dset_label_id);
-    H5Fclose(file_id);
+    H5Tclose(data_type);
+    if (write_raw) {
+        msync(raw_base, raw_header.file_size, MS_SYNC);
+        munmap(raw_base, raw_header.file_size);
+    } else {
+        H5Pclose(plist_id);
+        H5Dclose(dset_data_id);
+        H5Dclose(dset_label_id);
+        H5Fclose(file_id);
+    }
     if (compute_mean) {
         MPI_OUT << "Computing Mean" <<  std::endl;
         // float global_mean[channels * height * width];
@@ -192,7 +333,7 @@ int main(int argc, char *argv[]) {
             }
         }
         MPI_OUT << "Writing Mean to File" <<  std::endl;
-        hid_t mean_file = create_hdf5_file(std::string(argv[4]));
+        hid_t mean_file = create_hdf5_file(std::string(args[4]));
         hsize_t dim[] = {channels, height, width};
         hid_t dataspace = H5Screate_simple(3, dim, NULL);
         hid_t dset_id = H5Dcreate(mean_file, "mean", H5T_NATIVE_FLOAT, 